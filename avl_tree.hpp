@@ -0,0 +1,149 @@
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+/*
+    AVL tree class
+    A binary search tree whose subtrees differ in height by at most one,
+    so the tree is never more than about 1.44 log2(n) deep whatever order
+    the keys arrive in. Inserts and erases use the BST leaf insert and
+    successor splice, then walk parent pointers back up fixing heights
+    and rotating with the BST rotations where a node has gone out of
+    balance. Unlike the treap the bound holds for every tree, not just
+    on average, which keeps the slowest lookups close to the typical one.
+*/
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "binary_search_tree.hpp"
+
+template <typename T, typename Key = int>
+struct AVLNode
+{
+    Key key;
+    T value;
+    AVLNode *left, *right, *parent;
+    int size;
+    int height; // of the subtree, a leaf is 1
+    template <typename... Args>
+    AVLNode(const Key &k, Args &&...args) : key(k), value(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent(nullptr), size(1), height(1) {}
+};
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename node_T = AVLNode<T, Key>, typename alloc_T = PoolAllocator>
+class AVLTree : public BST<T, Key, Compare, node_T, alloc_T>
+{
+protected:
+    static int height(const node_T *node) { return node == nullptr ? 0 : node->height; }
+    static int balance(const node_T *node) { return height(node->left) - height(node->right); }
+    static void update_height(node_T *node) { node->height = 1 + std::max(height(node->left), height(node->right)); }
+    static int set_heights(node_T *node);
+    node_T *rebalance(node_T *node);
+    void retrace(node_T *node);
+
+public:
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    int get_height() const { return height(this->root); }
+};
+
+// Restores the height and balance of node once its subtrees are balanced and
+// differ in height by at most two. Returns the node now at its position
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *AVLTree<T, Key, Compare, node_T, alloc_T>::rebalance(node_T *node)
+{
+    auto &slot = this->link(node);
+    auto factor = balance(node);
+    if (factor > 1)
+    {
+        if (balance(node->left) < 0) // left right case, straighten it first
+        {
+            this->rotate_left(node->left);
+            update_height(node->left->left);
+            update_height(node->left);
+        }
+        this->rotate_right(slot);
+        update_height(node);
+        update_height(slot);
+        return slot;
+    }
+    if (factor < -1)
+    {
+        if (balance(node->right) > 0) // right left case
+        {
+            this->rotate_right(node->right);
+            update_height(node->right->right);
+            update_height(node->right);
+        }
+        this->rotate_left(slot);
+        update_height(node);
+        update_height(slot);
+        return slot;
+    }
+    update_height(node);
+    return node;
+}
+
+// Fixes node and its ancestors, stopping at the first subtree whose height
+// did not change as nothing above it can have moved out of balance
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void AVLTree<T, Key, Compare, node_T, alloc_T>::retrace(node_T *node)
+{
+    while (node != nullptr)
+    {
+        auto old_height = node->height;
+        node = rebalance(node);
+        if (node->height == old_height)
+            return;
+        node = node->parent;
+    }
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename... Args>
+std::pair<T *, bool> AVLTree<T, Key, Compare, node_T, alloc_T>::emplace(const Key &key, Args &&...args)
+{
+    auto [node, inserted] = this->emplace_leaf(key, std::forward<Args>(args)...);
+    if (inserted)
+        retrace(node->parent);
+    return {&node->value, inserted};
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void AVLTree<T, Key, Compare, node_T, alloc_T>::erase(const Key &key)
+{
+    auto node = this->find_node(key, this->resume(key));
+    if (node == nullptr)
+        return;
+    // the successor takes over node's position, and with it node's height
+    if (node->left != nullptr && node->right != nullptr)
+        this->successor(node)->height = node->height;
+    auto lowest = this->unlink_node(node);
+    this->free_node(node);
+    this->finger = lowest;
+    retrace(lowest);
+}
+
+// The midpoint build is already balanced, only the heights need filling in
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+int AVLTree<T, Key, Compare, node_T, alloc_T>::set_heights(node_T *node)
+{
+    if (node == nullptr)
+        return 0;
+    node->height = 1 + std::max(set_heights(node->left), set_heights(node->right));
+    return node->height;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void AVLTree<T, Key, Compare, node_T, alloc_T>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    BST<T, Key, Compare, node_T, alloc_T>::bulk_load(items);
+    set_heights(this->root);
+}
+
+#endif
@@ -0,0 +1,682 @@
+#ifndef B_PLUS_TREE_H
+#define B_PLUS_TREE_H
+
+/*
+    B+ tree class
+    Cache conscious alternative to the binary trees, every node holds up
+    to node_keys keys in a contiguous cache line aligned array that is
+    searched with vector compares for int and 64 bit keys (see
+    key_traits.hpp), so a lookup touches a handful of nodes instead of
+    one node per comparison.
+    Values only live in the leaves, which are linked in key order for
+    range scans.
+    The height is tracked so a search knows when it has reached the
+    leaves and nodes need no type tag.
+    Nodes come from alloc_T, see node_pool.hpp
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "ordered_map.hpp"
+#include "node_pool.hpp"
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename alloc_T = PoolAllocator, int node_keys = 64>
+class BPlusTree : public OrderedMap<T, Key, Compare>
+{
+private:
+    using order = KeyOrder<Key, Compare>;
+    static_assert(node_keys >= 4, "nodes must hold at least four keys");
+    static constexpr int min_keys = node_keys / 2; // every node but the root holds at least this many
+    static constexpr int max_height = 32;
+    struct Inner
+    {
+        alignas(64) Key keys[node_keys]; // child i holds keys in [keys[i-1], keys[i])
+        int count;
+        void *children[node_keys + 1];
+        Inner() : count(0) {}
+    };
+    struct Leaf
+    {
+        alignas(64) Key keys[node_keys];
+        int count;
+        Leaf *prev, *next;
+        T values[node_keys];
+        Leaf() : count(0), prev(nullptr), next(nullptr) {}
+    };
+    void *root;
+    int height; // 0 when empty, 1 when the root is a leaf
+    int sz;
+    alloc_T alloc;
+    mutable ShapeCounters counters;
+
+    Leaf *find_leaf(const Key &key) const;
+    Leaf *first_leaf() const;
+    Leaf *last_leaf() const;
+    std::pair<Leaf *, int> bound(const Key &key, bool inclusive) const;
+    T *split_leaf(Leaf *leaf, int pos, const Key &key, T &&value, Inner **path, int *slot);
+    void insert_separator(Key key, void *child, Inner **path, int *slot, int depth);
+    void rebalance_leaf(Leaf *leaf, Inner *parent, int i);
+    bool rebalance_inner(Inner *node, Inner *parent, int i);
+    void destroy(void *node, int depth);
+    long count_inner(const void *node, int depth) const;
+
+public:
+    using Visitor = typename OrderedMap<T, Key, Compare>::Visitor;
+    BPlusTree() : root(nullptr), height(0), sz(0) {}
+    BPlusTree(const BPlusTree &) = delete;
+    BPlusTree &operator=(const BPlusTree &) = delete;
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    void clear() override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    void range(const Key &lo, const Key &hi, Visitor visit) const override;
+    void for_each(Visitor visit) const override;
+    bool lower_bound(const Key &key, Key &found, T &value) const override;
+    bool upper_bound(const Key &key, Key &found, T &value) const override;
+    MemoryUsage memory_usage() const override;
+    ShapeStats shape_stats() const override;
+    void reset_counters() override { counters.reset(); }
+    int size() const { return sz; }
+    int get_height() const { return height; }
+    ~BPlusTree() { clear(); }
+
+    // A position in a leaf, steps move along the leaf chain
+    class Iterator
+    {
+    private:
+        Leaf *leaf;
+        int pos;
+        const BPlusTree *tree; // end() has no leaf, decrementing it needs the last one
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = OrderedEntry<T, Key>;
+        Iterator(Leaf *l, int p, const BPlusTree *t) : leaf(l), pos(p), tree(t) {}
+        Iterator &operator++()
+        {
+            if (++pos == leaf->count)
+            {
+                leaf = leaf->next;
+                pos = 0;
+            }
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+        Iterator &operator--()
+        {
+            if (leaf == nullptr || pos == 0)
+            {
+                leaf = leaf == nullptr ? tree->last_leaf() : leaf->prev;
+                pos = leaf->count;
+            }
+            pos--;
+            return *this;
+        }
+        Iterator operator--(int)
+        {
+            auto temp = *this;
+            --*this;
+            return temp;
+        }
+        reference operator*() const { return reference(leaf->keys[pos], leaf->values[pos]); }
+        bool operator==(const Iterator &rhs) const { return leaf == rhs.leaf && pos == rhs.pos; }
+        bool operator!=(const Iterator &rhs) const { return !(*this == rhs); }
+    };
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const { return Iterator(root == nullptr ? nullptr : first_leaf(), 0, this); }
+    Iterator end() const { return Iterator(nullptr, 0, this); }
+    ReverseIterator rbegin() const { return ReverseIterator(end()); }
+    ReverseIterator rend() const { return ReverseIterator(begin()); }
+    Iterator lower_bound(const Key &key) const
+    {
+        auto [leaf, pos] = bound(key, true);
+        return Iterator(leaf, pos, this);
+    }
+    Iterator upper_bound(const Key &key) const
+    {
+        auto [leaf, pos] = bound(key, false);
+        return Iterator(leaf, pos, this);
+    }
+};
+
+// Values move between slots and leaves as keys come and go
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+struct stable_values<BPlusTree<T, Key, Compare, alloc_T, node_keys>> : std::false_type
+{
+};
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+typename BPlusTree<T, Key, Compare, alloc_T, node_keys>::Leaf *BPlusTree<T, Key, Compare, alloc_T, node_keys>::find_leaf(const Key &key) const
+{
+    auto probe = counters.probe();
+    auto node = root;
+    for (int d = 1; d < height; d++)
+    {
+        auto inner = static_cast<Inner *>(node);
+        probe.step();
+        probe.compare(binary_search_comparisons(inner->count));
+        node = inner->children[count_less_equal_keys<Key, Compare>(inner->keys, inner->count, key)];
+    }
+    // the caller searches the leaf
+    probe.step();
+    probe.compare(binary_search_comparisons(static_cast<Leaf *>(node)->count));
+    return static_cast<Leaf *>(node);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+T *BPlusTree<T, Key, Compare, alloc_T, node_keys>::lookup(const Key &key)
+{
+    if (root == nullptr)
+        return nullptr;
+    auto leaf = find_leaf(key);
+    auto pos = count_less_keys<Key, Compare>(leaf->keys, leaf->count, key);
+    if (pos < leaf->count && order::equal(leaf->keys[pos], key))
+        return &leaf->values[pos];
+    return nullptr;
+}
+
+// Leaf slots always hold a live value, so a new one is built once from args
+// and moved into its slot
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+template <typename... Args>
+std::pair<T *, bool> BPlusTree<T, Key, Compare, alloc_T, node_keys>::emplace(const Key &key, Args &&...args)
+{
+    if (root == nullptr)
+    {
+        root = create_node<Leaf>(alloc);
+        height = 1;
+    }
+    auto probe = counters.probe();
+    Inner *path[max_height];
+    int slot[max_height];
+    auto node = root;
+    for (int d = 0; d < height - 1; d++)
+    {
+        auto inner = static_cast<Inner *>(node);
+        probe.step();
+        probe.compare(binary_search_comparisons(inner->count));
+        path[d] = inner;
+        slot[d] = count_less_equal_keys<Key, Compare>(inner->keys, inner->count, key);
+        node = inner->children[slot[d]];
+    }
+    auto leaf = static_cast<Leaf *>(node);
+    probe.step();
+    probe.compare(binary_search_comparisons(leaf->count));
+    auto pos = count_less_keys<Key, Compare>(leaf->keys, leaf->count, key);
+    if (pos < leaf->count && order::equal(leaf->keys[pos], key))
+        return {&leaf->values[pos], false};
+    T value(std::forward<Args>(args)...);
+    sz++;
+    counters.update();
+    if (leaf->count == node_keys)
+        return {split_leaf(leaf, pos, key, std::move(value), path, slot), true};
+    std::move_backward(leaf->keys + pos, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+    std::move_backward(leaf->values + pos, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+    leaf->keys[pos] = key;
+    leaf->values[pos] = std::move(value);
+    leaf->count++;
+    return {&leaf->values[pos], true};
+}
+
+// Moves the upper half of a full leaf to a new right sibling, puts the new
+// entry in whichever half it belongs to and passes the split up the path.
+// Returns where the new value ended up
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+T *BPlusTree<T, Key, Compare, alloc_T, node_keys>::split_leaf(Leaf *leaf, int pos, const Key &key, T &&value, Inner **path, int *slot)
+{
+    auto right = create_node<Leaf>(alloc);
+    auto half = node_keys / 2;
+    std::move(leaf->keys + half, leaf->keys + node_keys, right->keys);
+    std::move(leaf->values + half, leaf->values + node_keys, right->values);
+    right->count = node_keys - half;
+    leaf->count = half;
+    right->next = leaf->next;
+    right->prev = leaf;
+    if (leaf->next != nullptr)
+        leaf->next->prev = right;
+    leaf->next = right;
+
+    auto target = leaf;
+    if (pos > half)
+    {
+        target = right;
+        pos -= half;
+    }
+    std::move_backward(target->keys + pos, target->keys + target->count, target->keys + target->count + 1);
+    std::move_backward(target->values + pos, target->values + target->count, target->values + target->count + 1);
+    target->keys[pos] = key;
+    target->values[pos] = std::move(value);
+    target->count++;
+    insert_separator(right->keys[0], right, path, slot, height - 2);
+    return &target->values[pos];
+}
+
+// Inserts key with child to its right into path[depth], splitting inner
+// nodes up the path and growing a new root when the old one splits
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::insert_separator(Key key, void *child, Inner **path, int *slot, int depth)
+{
+    for (; depth >= 0; depth--)
+    {
+        auto inner = path[depth];
+        auto i = slot[depth];
+        if (inner->count < node_keys)
+        {
+            std::move_backward(inner->keys + i, inner->keys + inner->count, inner->keys + inner->count + 1);
+            std::move_backward(inner->children + i + 1, inner->children + inner->count + 1, inner->children + inner->count + 2);
+            inner->keys[i] = key;
+            inner->children[i + 1] = child;
+            inner->count++;
+            return;
+        }
+        // lay out the node with the new separator in place, then cut it at the middle key
+        Key keys[node_keys + 1];
+        void *children[node_keys + 2];
+        std::move(inner->keys, inner->keys + i, keys);
+        keys[i] = std::move(key);
+        std::move(inner->keys + i, inner->keys + node_keys, keys + i + 1);
+        std::copy(inner->children, inner->children + i + 1, children);
+        children[i + 1] = child;
+        std::copy(inner->children + i + 1, inner->children + node_keys + 1, children + i + 2);
+
+        auto mid = (node_keys + 1) / 2;
+        auto right = create_node<Inner>(alloc);
+        inner->count = mid;
+        std::move(keys, keys + mid, inner->keys);
+        std::copy(children, children + mid + 1, inner->children);
+        right->count = node_keys - mid;
+        std::move(keys + mid + 1, keys + node_keys + 1, right->keys);
+        std::copy(children + mid + 1, children + node_keys + 2, right->children);
+        key = std::move(keys[mid]);
+        child = right;
+    }
+    auto new_root = create_node<Inner>(alloc);
+    new_root->count = 1;
+    new_root->keys[0] = key;
+    new_root->children[0] = root;
+    new_root->children[1] = child;
+    root = new_root;
+    height++;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::erase(const Key &key)
+{
+    if (root == nullptr)
+        return;
+    auto probe = counters.probe();
+    Inner *path[max_height];
+    int slot[max_height];
+    auto node = root;
+    for (int d = 0; d < height - 1; d++)
+    {
+        auto inner = static_cast<Inner *>(node);
+        probe.step();
+        probe.compare(binary_search_comparisons(inner->count));
+        path[d] = inner;
+        slot[d] = count_less_equal_keys<Key, Compare>(inner->keys, inner->count, key);
+        node = inner->children[slot[d]];
+    }
+    auto leaf = static_cast<Leaf *>(node);
+    probe.step();
+    probe.compare(binary_search_comparisons(leaf->count));
+    auto pos = count_less_keys<Key, Compare>(leaf->keys, leaf->count, key);
+    if (pos == leaf->count || !order::equal(leaf->keys[pos], key))
+        return;
+    std::move(leaf->keys + pos + 1, leaf->keys + leaf->count, leaf->keys + pos);
+    std::move(leaf->values + pos + 1, leaf->values + leaf->count, leaf->values + pos);
+    leaf->count--;
+    sz--;
+    counters.update();
+
+    if (height == 1)
+    {
+        if (leaf->count == 0)
+        {
+            destroy_node(alloc, leaf);
+            root = nullptr;
+            height = 0;
+        }
+        return;
+    }
+    if (leaf->count >= min_keys)
+        return;
+    rebalance_leaf(leaf, path[height - 2], slot[height - 2]);
+    // a merge takes a key out of the parent, which may in turn underflow
+    for (int d = height - 2; d > 0 && path[d]->count < min_keys; d--)
+        if (!rebalance_inner(path[d], path[d - 1], slot[d - 1]))
+            break;
+    auto top = static_cast<Inner *>(root);
+    if (top->count == 0)
+    {
+        root = top->children[0];
+        destroy_node(alloc, top);
+        height--;
+    }
+}
+
+// leaf is child i of parent and has one entry too few, borrow an entry
+// from a sibling that can spare one or merge with a sibling that cannot
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::rebalance_leaf(Leaf *leaf, Inner *parent, int i)
+{
+    if (i > 0)
+    {
+        auto left = static_cast<Leaf *>(parent->children[i - 1]);
+        if (left->count > min_keys)
+        {
+            std::move_backward(leaf->keys, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+            std::move_backward(leaf->values, leaf->values + leaf->count, leaf->values + leaf->count + 1);
+            leaf->keys[0] = left->keys[left->count - 1];
+            leaf->values[0] = std::move(left->values[left->count - 1]);
+            leaf->count++;
+            left->count--;
+            parent->keys[i - 1] = leaf->keys[0];
+            return;
+        }
+    }
+    if (i < parent->count)
+    {
+        auto right = static_cast<Leaf *>(parent->children[i + 1]);
+        if (right->count > min_keys)
+        {
+            leaf->keys[leaf->count] = right->keys[0];
+            leaf->values[leaf->count] = std::move(right->values[0]);
+            leaf->count++;
+            std::move(right->keys + 1, right->keys + right->count, right->keys);
+            std::move(right->values + 1, right->values + right->count, right->values);
+            right->count--;
+            parent->keys[i] = right->keys[0];
+            return;
+        }
+    }
+    // merge the right one of the pair into the left one
+    if (i == parent->count)
+        i--;
+    auto left = static_cast<Leaf *>(parent->children[i]);
+    auto right = static_cast<Leaf *>(parent->children[i + 1]);
+    std::move(right->keys, right->keys + right->count, left->keys + left->count);
+    std::move(right->values, right->values + right->count, left->values + left->count);
+    left->count += right->count;
+    left->next = right->next;
+    if (right->next != nullptr)
+        right->next->prev = left;
+    destroy_node(alloc, right);
+    std::move(parent->keys + i + 1, parent->keys + parent->count, parent->keys + i);
+    std::move(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+    parent->count--;
+}
+
+// Same as rebalance_leaf for an inner node, separators rotate through the
+// parent. Returns true when a merge took a key out of the parent
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+bool BPlusTree<T, Key, Compare, alloc_T, node_keys>::rebalance_inner(Inner *node, Inner *parent, int i)
+{
+    if (i > 0)
+    {
+        auto left = static_cast<Inner *>(parent->children[i - 1]);
+        if (left->count > min_keys)
+        {
+            std::move_backward(node->keys, node->keys + node->count, node->keys + node->count + 1);
+            std::move_backward(node->children, node->children + node->count + 1, node->children + node->count + 2);
+            node->keys[0] = parent->keys[i - 1];
+            node->children[0] = left->children[left->count];
+            node->count++;
+            parent->keys[i - 1] = left->keys[left->count - 1];
+            left->count--;
+            return false;
+        }
+    }
+    if (i < parent->count)
+    {
+        auto right = static_cast<Inner *>(parent->children[i + 1]);
+        if (right->count > min_keys)
+        {
+            node->keys[node->count] = parent->keys[i];
+            node->children[node->count + 1] = right->children[0];
+            node->count++;
+            parent->keys[i] = right->keys[0];
+            std::move(right->keys + 1, right->keys + right->count, right->keys);
+            std::move(right->children + 1, right->children + right->count + 1, right->children);
+            right->count--;
+            return false;
+        }
+    }
+    if (i == parent->count)
+        i--;
+    auto left = static_cast<Inner *>(parent->children[i]);
+    auto right = static_cast<Inner *>(parent->children[i + 1]);
+    left->keys[left->count] = parent->keys[i];
+    std::copy(right->keys, right->keys + right->count, left->keys + left->count + 1);
+    std::copy(right->children, right->children + right->count + 1, left->children + left->count + 1);
+    left->count += right->count + 1;
+    destroy_node(alloc, right);
+    std::move(parent->keys + i + 1, parent->keys + parent->count, parent->keys + i);
+    std::move(parent->children + i + 2, parent->children + parent->count + 1, parent->children + i + 1);
+    parent->count--;
+    return true;
+}
+
+// Packs the sorted items into leaves bottom up, then builds each inner
+// level over the one below. Nodes are filled evenly so none underflows
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    clear();
+    int n = items.size();
+    if (n == 0)
+        return;
+    std::vector<std::pair<void *, Key>> level; // node and the smallest key below it
+    int leaves = (n + node_keys - 1) / node_keys;
+    Leaf *prev = nullptr;
+    for (int l = 0, begin = 0; l < leaves; l++)
+    {
+        auto end = int((long(n) * (l + 1)) / leaves);
+        auto leaf = create_node<Leaf>(alloc);
+        for (int i = begin; i < end; i++)
+        {
+            leaf->keys[i - begin] = items[i].first;
+            leaf->values[i - begin] = items[i].second;
+        }
+        leaf->count = end - begin;
+        leaf->prev = prev;
+        if (prev != nullptr)
+            prev->next = leaf;
+        prev = leaf;
+        level.emplace_back(leaf, items[begin].first);
+        begin = end;
+    }
+    height = 1;
+    while (level.size() > 1)
+    {
+        int c = level.size();
+        int groups = (c + node_keys) / (node_keys + 1);
+        std::vector<std::pair<void *, Key>> above;
+        for (int g = 0, begin = 0; g < groups; g++)
+        {
+            auto end = int((long(c) * (g + 1)) / groups);
+            auto inner = create_node<Inner>(alloc);
+            for (int i = begin; i < end; i++)
+            {
+                inner->children[i - begin] = level[i].first;
+                if (i > begin)
+                    inner->keys[i - begin - 1] = level[i].second;
+            }
+            inner->count = end - begin - 1;
+            above.emplace_back(inner, level[begin].second);
+            begin = end;
+        }
+        level.swap(above);
+        height++;
+    }
+    root = level[0].first;
+    sz = n;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+typename BPlusTree<T, Key, Compare, alloc_T, node_keys>::Leaf *BPlusTree<T, Key, Compare, alloc_T, node_keys>::first_leaf() const
+{
+    auto node = root;
+    for (int d = 1; d < height; d++)
+        node = static_cast<Inner *>(node)->children[0];
+    return static_cast<Leaf *>(node);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+typename BPlusTree<T, Key, Compare, alloc_T, node_keys>::Leaf *BPlusTree<T, Key, Compare, alloc_T, node_keys>::last_leaf() const
+{
+    auto node = root;
+    for (int d = 1; d < height; d++)
+    {
+        auto inner = static_cast<Inner *>(node);
+        node = inner->children[inner->count];
+    }
+    return static_cast<Leaf *>(node);
+}
+
+// The leaf and slot of the first key >= key when inclusive, > key otherwise,
+// a leaf of nullptr when there is none
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+std::pair<typename BPlusTree<T, Key, Compare, alloc_T, node_keys>::Leaf *, int> BPlusTree<T, Key, Compare, alloc_T, node_keys>::bound(const Key &key, bool inclusive) const
+{
+    if (root == nullptr)
+        return {nullptr, 0};
+    auto leaf = find_leaf(key);
+    auto pos = inclusive ? count_less_keys<Key, Compare>(leaf->keys, leaf->count, key) : count_less_equal_keys<Key, Compare>(leaf->keys, leaf->count, key);
+    if (pos == leaf->count)
+        return {leaf->next, 0};
+    return {leaf, pos};
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::range(const Key &lo, const Key &hi, Visitor visit) const
+{
+    auto [leaf, pos] = bound(lo, true);
+    while (leaf != nullptr)
+    {
+        for (; pos < leaf->count; pos++)
+        {
+            if (!order::less(leaf->keys[pos], hi))
+                return;
+            visit(leaf->keys[pos], leaf->values[pos]);
+        }
+        leaf = leaf->next;
+        pos = 0;
+    }
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::for_each(Visitor visit) const
+{
+    for (auto leaf = root == nullptr ? nullptr : first_leaf(); leaf != nullptr; leaf = leaf->next)
+        for (int pos = 0; pos < leaf->count; pos++)
+            visit(leaf->keys[pos], leaf->values[pos]);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+bool BPlusTree<T, Key, Compare, alloc_T, node_keys>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto [leaf, pos] = bound(key, true);
+    if (leaf == nullptr)
+        return false;
+    found = leaf->keys[pos];
+    value = leaf->values[pos];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+bool BPlusTree<T, Key, Compare, alloc_T, node_keys>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto [leaf, pos] = bound(key, false);
+    if (leaf == nullptr)
+        return false;
+    found = leaf->keys[pos];
+    value = leaf->values[pos];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::destroy(void *node, int depth)
+{
+    if (depth == height)
+    {
+        destroy_node(alloc, static_cast<Leaf *>(node));
+        return;
+    }
+    auto inner = static_cast<Inner *>(node);
+    for (int i = 0; i <= inner->count; i++)
+        destroy(inner->children[i], depth + 1);
+    destroy_node(alloc, inner);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+long BPlusTree<T, Key, Compare, alloc_T, node_keys>::count_inner(const void *node, int depth) const
+{
+    if (depth == height)
+        return 0;
+    auto inner = static_cast<const Inner *>(node);
+    long count = 1;
+    for (int i = 0; i <= inner->count; i++)
+        count += count_inner(inner->children[i], depth + 1);
+    return count;
+}
+
+// Leaves are the nodes, the empty slots in them included. Inner nodes are auxiliary
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+MemoryUsage BPlusTree<T, Key, Compare, alloc_T, node_keys>::memory_usage() const
+{
+    MemoryUsage usage;
+    auto leaf_bytes = alloc.block_size(sizeof(Leaf));
+    for (auto leaf = first_leaf(); leaf != nullptr; leaf = leaf->next)
+    {
+        for (int i = 0; i < leaf->count; i++)
+            usage.add_entry(leaf->keys[i], leaf->values[i]);
+        usage.nodes++;
+        usage.node_bytes += leaf_bytes - leaf->count * sizeof(T);
+    }
+    auto inner_bytes = (root == nullptr ? 0 : count_inner(root, 1)) * alloc.block_size(sizeof(Inner));
+    usage.aux_bytes = sizeof(*this) + inner_bytes + allocator_slack(alloc, usage.nodes * leaf_bytes + inner_bytes);
+    return usage;
+}
+
+// Every key is in a leaf, so every search takes height nodes
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+ShapeStats BPlusTree<T, Key, Compare, alloc_T, node_keys>::shape_stats() const
+{
+    ShapeStats stats;
+    stats.height = height;
+    stats.mean_depth = height;
+    counters.report(stats);
+    return stats;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T, int node_keys>
+void BPlusTree<T, Key, Compare, alloc_T, node_keys>::clear()
+{
+    if constexpr (trivially_released<Leaf, alloc_T>)
+        alloc.release(); // nothing to destroy so the nodes go with their chunks
+    else if (root != nullptr)
+        destroy(root, 1);
+    root = nullptr;
+    height = 0;
+    sz = 0;
+}
+
+#endif
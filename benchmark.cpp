@@ -1,106 +1,1161 @@
 /*
-    Benchmarking the data structures written as teaching execises 
-    Written by Dylan Janssen 
+    Benchmarking the data structures written as teaching execises
+    Written by Dylan Janssen
+
+    Every structure is driven through the Map<T> interface, std::map is
+    wrapped in the same interface as the baseline. Ordered structures also
+    run range scans of 32 keys through OrderedMap<T>. Each workload is timed
+    in samples of a fixed number of operations with a steady clock after
+    warmup runs. Each sample is the mean time per operation of its block,
+    so the median, p99 and min reported are over blocks of --sample
+    operations, not single ones (--sample 1 gives those), next to the
+    mean nanoseconds per operation.
+
+    --mode search instead times the vectorised lower bound kernel against
+    std::lower_bound, a scalar kernel, BST::find, the skip list, std::map,
+    the B+ tree and the frozen EytzingerMap on random hits into n sorted
+    keys. The B+ tree also runs with 64 bit keys, ten digit InlineString
+    keys and the same keys as std::string. The BST, treap and skip list
+    also run find_many over blocks of 64 queries, their searches overlapped.
+
+    --mode dispatch runs the same workloads on shuffled keys twice per
+    structure, once through Map<T> & and once through DirectMap, which
+    binds each call statically so the loops below are inlined per type.
+
+    --mode concurrent runs 1, 2, 4 ... --threads threads against the lock
+    free skip list, a std::map behind a shared_mutex and every structure
+    split over ShardedMap's independently locked shards, each thread doing
+    n finds, inserts and erases at 50%, 90% and 99% reads. Alongside the
+    per operation latencies it reports the combined throughput.
+
+    --mode snapshot times rebuilding each structure from shuffled keys one
+    insert at a time against saving it to a snapshot file and loading it
+    back, per key, then opening a snapshot of int values with
+    MappedSnapshot and finding every key in it without loading it.
+
+    --mode memory builds each structure from shuffled keys, timing the
+    inserts and finds, and reports its memory_usage(): bytes per key and
+    the bytes in nodes, values and everything else.
+
+    --mode shape inserts, finds and erases every key in ordered, reversed
+    and shuffled order, reporting each structure's height, mean key depth
+    and skip list level histogram after the inserts. Built with
+    -DDS_ENABLE_COUNTERS it also reports per phase the mean and longest
+    search path, comparisons per search and rotations per update.
+
+    --mode check times nothing. It builds the skip list and treap with the
+    parallel bulk load, erases every other key, fills the gaps and tears
+    them down, exiting with 1 if either ends up with the wrong keys.
+
+    USAGE: ./program_name #number_of_keys [--mode maps|search|dispatch|concurrent|snapshot|memory|shape|check]
+           [--reps N] [--warmup N] [--sample N] [--format text|csv|json]
+           [--structures a,b,...] [--seed N] [--threads N]
 */
 
-#include <iostream> 
-#include <vector> 
-#include <numeric> 
-#include <map> 
-#include <set> 
-#include <random> 
-#include <string> 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <shared_mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
-// Include data structures 
+// Include data structures
 #include "map.hpp"
+#include "ordered_map.hpp"
 #include "linked_list.hpp"
 #include "skip_list.hpp"
 #include "treap.hpp"
+#include "avl_tree.hpp"
 #include "binary_search_tree.hpp"
+#include "b_plus_tree.hpp"
+#include "sorted_array_map.hpp"
+#include "snapshot.hpp"
+#include "eytzinger_map.hpp"
+#include "simd_search.hpp"
+#include "concurrent_skip_list.hpp"
+#include "sharded_map.hpp"
+#include "hash_indexed.hpp"
+
+// std::map behind the Map interface so the baseline pays the same virtual call
+template <typename T>
+class StdMap : public OrderedMap<T>
+{
+private:
+    std::map<int, T> map;
+
+    bool entry(typename std::map<int, T>::const_iterator it, int &found, T &value) const
+    {
+        if (it == map.end())
+            return false;
+        found = it->first;
+        value = it->second;
+        return true;
+    }
+
+public:
+    using Visitor = typename OrderedMap<T>::Visitor;
+    void insert(const int &key, const T &value) override { map.insert_or_assign(key, value); }
+    void insert(const int &key, T &&value) override { map.insert_or_assign(key, std::move(value)); }
+    void erase(const int &key) override { map.erase(key); }
+    T *lookup(const int &key) override
+    {
+        auto it = map.find(key);
+        return it == map.end() ? nullptr : &it->second;
+    }
+    void clear() override { map.clear(); }
+    // a red black node is its colour and three links ahead of the pair,
+    // allocator overhead per node is not counted
+    MemoryUsage memory_usage() const override
+    {
+        MemoryUsage usage;
+        for (const auto &[key, value] : map)
+            usage.add_entry(key, value);
+        usage.nodes = map.size();
+        usage.node_bytes += map.size() * (4 * sizeof(void *) + sizeof(std::pair<const int, T>) - sizeof(T));
+        usage.aux_bytes = sizeof(*this);
+        return usage;
+    }
+    void range(const int &lo, const int &hi, Visitor visit) const override
+    {
+        for (auto it = map.lower_bound(lo); it != map.end() && it->first < hi; ++it)
+            visit(it->first, it->second);
+    }
+    void for_each(Visitor visit) const override
+    {
+        for (const auto &[key, value] : map)
+            visit(key, value);
+    }
+    bool lower_bound(const int &key, int &found, T &value) const override { return entry(map.lower_bound(key), found, value); }
+    bool upper_bound(const int &key, int &found, T &value) const override { return entry(map.upper_bound(key), found, value); }
+};
+
+// The concurrent baseline, readers share the lock and writers take it alone
+template <typename T>
+class LockedStdMap : public Map<T>
+{
+private:
+    StdMap<T> map;
+    std::shared_mutex lock;
+
+public:
+    void insert(const int &key, const T &value) override
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        map.insert(key, value);
+    }
+    void insert(const int &key, T &&value) override
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        map.insert(key, std::move(value));
+    }
+    void erase(const int &key) override
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        map.erase(key);
+    }
+    // the pointer is only safe to read while no writer runs, find copies under the lock
+    T *lookup(const int &key) override
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return map.lookup(key);
+    }
+    bool find(const int &key, T &value) override
+    {
+        std::shared_lock<std::shared_mutex> guard(lock);
+        return map.find(key, value);
+    }
+    void clear() override
+    {
+        std::unique_lock<std::shared_mutex> guard(lock);
+        map.clear();
+    }
+};
+
+struct Options
+{
+    int size = 0;
+    int reps = 5;
+    int warmup = 1;
+    int sample = 256; // operations timed together as one sample
+    std::string mode = "maps";
+    std::string format = "text";
+    std::vector<std::string> structures;
+    unsigned seed = 0;
+    int threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct Workload;
+
+struct Structure
+{
+    std::string name;
+    std::function<std::unique_ptr<Map<std::string>>()> make;
+    // run_once on a fresh instance through DirectMap
+    std::function<long(const Workload &, const Options &, std::vector<std::vector<double>> &)> run_direct;
+    // save_snapshot and load_snapshot on an instance from make
+    std::function<void(Map<std::string> &, const std::string &)> save, load;
+};
+
+struct Result
+{
+    std::string order, structure, operation;
+    long ops = 0;
+    std::size_t samples = 0;
+    double median = 0, p99 = 0, mean = 0, min = 0; // nanoseconds per operation, all but mean over sample blocks
+    double throughput = 0; // million operations per second over all threads, concurrent mode only
+    MemoryUsage memory; // memory mode only
+    bool shaped = false; // shape mode only
+    ShapeStats shape;
+};
 
+// A single operation of the mixed workload
+struct Op
+{
+    enum Kind { Find, Insert, Erase } kind;
+    int key;
+};
+
+using Clock = std::chrono::steady_clock;
 
-void benchmark_map(std::map<int, std::string> &s, const std::vector<int> &keys) 
+// Runs op(i) for every i in [0, n), timing each block of sample operations
+template <typename F>
+void timed(int n, int sample, std::vector<double> &samples, F op)
 {
-    std::string value; 
-    auto start = clock();
-    for (auto k : keys) 
-        s.insert({k, std::to_string(k)}); 
-    auto end = clock(); 
-    auto duration = double(end - start) / CLOCKS_PER_SEC; 
-    std::cout << "   Insert time: " << duration << std::endl; 
+    for (int begin = 0; begin < n; begin += sample)
+    {
+        auto end = std::min(n, begin + sample);
+        auto start = Clock::now();
+        for (int i = begin; i < end; i++)
+            op(i);
+        auto stop = Clock::now();
+        auto ns = std::chrono::duration<double, std::nano>(stop - start).count();
+        samples.push_back(ns / (end - begin));
+    }
+}
 
-    start = clock();
-    for (auto k : keys) 
-        if (s.find(k) == s.end())
-            std::cout << "Not found" << std::endl; 
-    end = clock(); 
-    duration = double(end - start) / CLOCKS_PER_SEC; 
-    std::cout << "   Search time: " << duration << std::endl; 
+Result summarise(std::vector<double> samples, long ops)
+{
+    Result r;
+    r.ops = ops;
+    r.samples = samples.size();
+    if (samples.empty())
+        return r;
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) { return samples[std::min(samples.size() - 1, std::size_t(q * samples.size()))]; };
+    r.median = at(0.5);
+    r.p99 = at(0.99);
+    r.min = samples.front();
+    r.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+    return r;
 }
 
-template <typename T>
-void benchmark(Map<T> &ds, const std::vector<int> &keys)
-{
-    std::string value; 
-    auto start = clock();
-    for (auto k : keys) 
-        ds.insert(k, std::to_string(k));
-    auto end = clock();
-    auto duration = double(end - start) / CLOCKS_PER_SEC; 
-    std::cout << "    Insert time: " << duration << std::endl; 
-    
-    start = clock();
-    for (auto k : keys) 
-        if (!ds.find(k, value))
-            std::cout << "Not found" << std::endl; 
-    end = clock();  
-    duration = double(end - start) / CLOCKS_PER_SEC;  
-    std::cout << "    Search time: " << duration << std::endl; 
-}
-
-void benchmark_datastructures(const std::vector<int> keys, const std::string type)
-{
-    std::cout << type << std::endl; 
-
-    LinkedList<std::string> linked_list; 
-    SkipList<std::string> skip_list; 
-    BST<std::string> bst; 
-    Treap<std::string> treap; 
-    std::map<int, std::string> map; 
-    
-    
-    std::cout << "  Linked List" << std::endl; 
-    benchmark(linked_list, keys); 
-    std::cout << "  Skip List" << std::endl; 
-    benchmark(skip_list, keys); 
-    std::cout << "  BST" << std::endl; 
-    benchmark(bst, keys); 
-    std::cout << "  Treap" << std::endl; 
-    benchmark(treap, keys); 
-    std::cout << "  STL std::map (red-black tree)" << std::endl; 
-    benchmark_map(map, keys);
-    std::cout << std::endl; 
-} 
+// Keys present in the structure are even so that key + 1 is always a miss
+struct Workload
+{
+    std::vector<int> keys, misses;
+    std::vector<std::string> values;
+    std::vector<Op> mixed;
+};
 
-int main(int argc, char **argv)
+Workload make_workload(const std::vector<int> &keys, std::mt19937 &rng)
+{
+    Workload w;
+    w.keys = keys;
+    for (auto k : keys)
+    {
+        w.misses.push_back(k + 1);
+        w.values.push_back(std::to_string(k));
+    }
+    // 80% finds, 10% inserts of new keys and 10% erases of existing keys
+    std::uniform_int_distribution<int> pick(0, keys.empty() ? 0 : keys.size() - 1);
+    std::uniform_int_distribution<int> kind(0, 9);
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        auto k = kind(rng);
+        auto key = keys.empty() ? 0 : keys[pick(rng)];
+        if (k == 0)
+            w.mixed.push_back({Op::Insert, key + 1});
+        else if (k == 1)
+            w.mixed.push_back({Op::Erase, key});
+        else
+            w.mixed.push_back({Op::Find, key});
+    }
+    return w;
+}
+
+static const std::vector<std::string> operations{"insert", "find-hit", "find-miss", "range", "erase", "mixed"};
+static const int range_keys = 32; // keys are even so a scan covers twice this span
+
+// Results of finds that are not checked are written here so they cannot be optimised away
+volatile long sink;
+
+// The ordered interface of a map, nullptr when it has none
+OrderedMap<std::string> *as_ordered(Map<std::string> &ds)
+{
+    return dynamic_cast<OrderedMap<std::string> *>(&ds);
+}
+
+template <typename M>
+auto as_ordered(DirectMap<M> &ds)
+{
+    if constexpr (std::is_base_of_v<OrderedMap<std::string>, M>)
+        return &ds;
+    else
+        return static_cast<OrderedMap<std::string> *>(nullptr);
+}
+
+// One full pass over every workload, samples[i] collects operations[i], returns the find-hit count.
+// D is Map<std::string> for virtual calls or a DirectMap for static ones
+template <typename D>
+long run_once(D &ds, const Workload &w, const Options &opts, std::vector<std::vector<double>> &samples)
 {
-    if (argc != 2) 
+    int n = w.keys.size();
+    long hits = 0, found = 0;
+    std::string value;
+    timed(n, opts.sample, samples[0], [&](int i) { ds.insert(w.keys[i], w.values[i]); });
+    // lookups read the value in place, a copy out would time std::string as well
+    timed(n, opts.sample, samples[1], [&](int i) { hits += ds.lookup(w.keys[i]) != nullptr; });
+    timed(n, opts.sample, samples[2], [&](int i) { found += ds.lookup(w.misses[i]) != nullptr; });
+    if (auto ordered = as_ordered(ds))
     {
-        std::cout << "USAGE: ./program_name #number_of_keys" << std::endl;
-        exit(1); 
+        long visited = 0;
+        timed(n, opts.sample, samples[3], [&](int i) {
+            ordered->range(w.keys[i], w.keys[i] + 2 * range_keys, [&](int, const std::string &) { visited++; });
+        });
+        found += visited;
     }
+    timed(n, opts.sample, samples[4], [&](int i) { ds.erase(w.keys[i]); });
 
-    const int size = std::stoi(argv[1]);
-    std::vector<int> keys(size);
-    iota(keys.begin(), keys.end(), 0); 
-    benchmark_datastructures(keys, "ordered data");
-    
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 0; i < n; i++)
+        items.emplace_back(w.keys[i], w.values[i]);
+    ds.insert_batch(items);
+    timed(n, opts.sample, samples[5], [&](int i) {
+        const auto &op = w.mixed[i];
+        if (op.kind == Op::Find)
+            found += ds.lookup(op.key) != nullptr;
+        else if (op.kind == Op::Insert)
+            ds.insert(op.key, value);
+        else
+            ds.erase(op.key);
+    });
+    sink = found;
+    return hits;
+}
+
+template <typename M>
+Structure structure(const std::string &name)
+{
+    return {name,
+            [] { return std::make_unique<M>(); },
+            [](const Workload &w, const Options &opts, std::vector<std::vector<double>> &samples) {
+                M map;
+                DirectMap<M> ds(map);
+                return run_once(ds, w, opts, samples);
+            },
+            [](Map<std::string> &map, const std::string &path) { save_snapshot(static_cast<M &>(map), path); },
+            [](Map<std::string> &map, const std::string &path) { load_snapshot(static_cast<M &>(map), path); }};
+}
+
+std::vector<Result> benchmark(const Structure &s, const Workload &w, const Options &opts, const std::string &order, bool direct = false)
+{
+    std::vector<std::vector<double>> samples(operations.size());
+    long hits = 0;
+    for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+    {
+        std::vector<std::vector<double>> rep_samples(operations.size());
+        if (direct)
+            hits += s.run_direct(w, opts, rep_samples);
+        else
+        {
+            auto ds = s.make();
+            hits += run_once(*ds, w, opts, rep_samples);
+        }
+        if (rep < opts.warmup)
+            continue;
+        for (std::size_t i = 0; i < samples.size(); i++)
+            samples[i].insert(samples[i].end(), rep_samples[i].begin(), rep_samples[i].end());
+    }
+    // every find-hit must succeed, anything else means the structure is broken
+    if (hits != long(opts.warmup + opts.reps) * long(w.keys.size()))
+        std::cerr << s.name << ": keys missing on " << order << " data" << std::endl;
+
+    std::vector<Result> results;
+    for (std::size_t i = 0; i < operations.size(); i++)
+    {
+        if (samples[i].empty()) // range scans on a structure that is not ordered
+            continue;
+        auto r = summarise(samples[i], long(opts.reps) * w.keys.size());
+        r.order = order;
+        r.structure = s.name;
+        r.operation = operations[i];
+        results.push_back(r);
+    }
+    return results;
+}
+
+void print_text(const std::vector<Result> &results)
+{
+    std::string order, structure;
+    for (const auto &r : results)
+    {
+        if (r.order != order)
+        {
+            order = r.order;
+            structure.clear();
+            std::cout << order << std::endl;
+        }
+        if (r.structure != structure)
+        {
+            structure = r.structure;
+            std::cout << "  " << structure << std::endl;
+        }
+        if (r.memory.keys > 0)
+        {
+            std::cout << std::fixed << std::setprecision(1)
+                      << "    " << std::left << std::setw(10) << r.operation << std::right
+                      << " " << std::setw(8) << r.memory.bytes_per_key() << " bytes/key"
+                      << "  nodes " << r.memory.nodes << "  node " << r.memory.node_bytes
+                      << " B  values " << r.memory.value_bytes << " B  aux " << r.memory.aux_bytes << " B" << std::endl;
+            continue;
+        }
+        std::cout << std::fixed << std::setprecision(1)
+                  << "    " << std::left << std::setw(10) << r.operation << std::right
+                  << " block median " << std::setw(10) << r.median << " ns/op"
+                  << "  block p99 " << std::setw(10) << r.p99 << " ns/op"
+                  << "  mean " << std::setw(10) << r.mean << " ns/op";
+        if (r.throughput > 0)
+            std::cout << "  " << std::setw(8) << r.throughput << " Mops/s";
+        std::cout << std::endl;
+        const auto &shape = r.shape;
+        if (!r.shaped || (shape.height == 0 && !shape.counted)) // nothing to say about std::map
+            continue;
+        std::cout << std::setprecision(2) << "               height " << shape.height << "  depth " << shape.mean_depth;
+        if (shape.counted)
+            std::cout << "  path " << shape.mean_path() << " (max " << shape.longest_path << ")"
+                      << "  compares " << shape.comparisons_per_search() << "  rotations " << shape.rotations_per_update();
+        if (!shape.levels.empty())
+        {
+            std::cout << "  levels";
+            for (auto count : shape.levels)
+                std::cout << ' ' << count;
+        }
+        std::cout << std::endl;
+    }
+}
+
+void print_csv(const std::vector<Result> &results)
+{
+    std::cout << "order,structure,operation,ops,samples,block_median_ns,block_p99_ns,mean_ns,block_min_ns,mops,"
+                 "bytes_per_key,nodes,node_bytes,value_bytes,aux_bytes,"
+                 "height,mean_depth,mean_path,longest_path,comparisons_per_search,rotations_per_update" << std::endl;
+    for (const auto &r : results)
+        std::cout << r.order << ',' << r.structure << ',' << r.operation << ',' << r.ops << ','
+                  << r.samples << ',' << r.median << ',' << r.p99 << ',' << r.mean << ',' << r.min << ','
+                  << r.throughput << ',' << r.memory.bytes_per_key() << ',' << r.memory.nodes << ','
+                  << r.memory.node_bytes << ',' << r.memory.value_bytes << ',' << r.memory.aux_bytes << ','
+                  << r.shape.height << ',' << r.shape.mean_depth << ',' << r.shape.mean_path() << ','
+                  << r.shape.longest_path << ',' << r.shape.comparisons_per_search() << ','
+                  << r.shape.rotations_per_update() << std::endl;
+}
+
+void print_json(const std::vector<Result> &results, const Options &opts)
+{
+    std::cout << "{\"keys\": " << opts.size << ", \"reps\": " << opts.reps << ", \"warmup\": " << opts.warmup
+              << ", \"sample\": " << opts.sample << ", \"results\": [" << std::endl;
+    for (std::size_t i = 0; i < results.size(); i++)
+    {
+        const auto &r = results[i];
+        std::cout << "  {\"order\": \"" << r.order << "\", \"structure\": \"" << r.structure
+                  << "\", \"operation\": \"" << r.operation << "\", \"ops\": " << r.ops
+                  << ", \"samples\": " << r.samples << ", \"block_median_ns\": " << r.median
+                  << ", \"block_p99_ns\": " << r.p99 << ", \"mean_ns\": " << r.mean << ", \"block_min_ns\": " << r.min
+                  << ", \"mops\": " << r.throughput << ", \"bytes_per_key\": " << r.memory.bytes_per_key()
+                  << ", \"nodes\": " << r.memory.nodes << ", \"node_bytes\": " << r.memory.node_bytes
+                  << ", \"value_bytes\": " << r.memory.value_bytes << ", \"aux_bytes\": " << r.memory.aux_bytes;
+        if (r.shaped)
+        {
+            const auto &shape = r.shape;
+            std::cout << ", \"height\": " << shape.height << ", \"mean_depth\": " << shape.mean_depth
+                      << ", \"counted\": " << (shape.counted ? "true" : "false")
+                      << ", \"searches\": " << shape.searches << ", \"mean_path\": " << shape.mean_path()
+                      << ", \"longest_path\": " << shape.longest_path
+                      << ", \"comparisons_per_search\": " << shape.comparisons_per_search()
+                      << ", \"updates\": " << shape.updates << ", \"rotations\": " << shape.rotations
+                      << ", \"rotations_per_update\": " << shape.rotations_per_update() << ", \"levels\": [";
+            for (std::size_t l = 0; l < shape.levels.size(); l++)
+                std::cout << (l > 0 ? ", " : "") << shape.levels[l];
+            std::cout << "]";
+        }
+        std::cout << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    std::cout << "]}" << std::endl;
+}
+
+std::vector<Structure> structures()
+{
+    return {
+        structure<LinkedList<std::string>>("linked-list"),
+        structure<SkipList<std::string>>("skip-list"),
+        structure<BST<std::string>>("bst"),
+        structure<Treap<std::string>>("treap"),
+        structure<AVLTree<std::string>>("avl"),
+        structure<BPlusTree<std::string>>("b+tree"),
+        structure<SortedArrayMap<std::string>>("sorted-array"),
+        structure<StdMap<std::string>>("std-map"),
+        structure<HashIndexed<SkipList<std::string>>>("hash-skip-list"),
+        structure<HashIndexed<Treap<std::string>>>("hash-treap"),
+        structure<HashIndexed<BST<std::string>>>("hash-bst"),
+    };
+}
+
+void usage()
+{
+    std::cout << "USAGE: ./program_name #number_of_keys [--mode maps|search|dispatch|concurrent|snapshot|memory|shape|check] [--reps N] [--warmup N] "
+                 "[--sample N] [--format text|csv|json] [--structures a,b,...] [--seed N] [--threads N]" << std::endl;
+    exit(1);
+}
+
+// std::stoi that calls usage() on anything but a number
+int parse_int(const std::string &text)
+{
+    try
+    {
+        return std::stoi(text);
+    }
+    catch (const std::logic_error &)
+    {
+        usage();
+    }
+    return 0;
+}
+
+Options parse(int argc, char **argv)
+{
+    if (argc < 2)
+        usage();
+    Options opts;
+    opts.size = parse_int(argv[1]);
+    opts.seed = std::chrono::system_clock::now().time_since_epoch().count();
+    for (int i = 2; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        if (i + 1 >= argc)
+            usage();
+        std::string next = argv[++i];
+        if (arg == "--reps")
+            opts.reps = parse_int(next);
+        else if (arg == "--warmup")
+            opts.warmup = parse_int(next);
+        else if (arg == "--sample")
+            opts.sample = std::max(1, parse_int(next));
+        else if (arg == "--mode")
+        {
+            static const std::vector<std::string> modes = {"maps", "search", "dispatch", "concurrent", "snapshot", "memory", "shape", "check"};
+            if (std::find(modes.begin(), modes.end(), next) == modes.end())
+                usage();
+            opts.mode = next;
+        }
+        else if (arg == "--format")
+        {
+            if (next != "text" && next != "csv" && next != "json")
+                usage();
+            opts.format = next;
+        }
+        else if (arg == "--seed")
+        {
+            try
+            {
+                opts.seed = std::stoul(next);
+            }
+            catch (const std::logic_error &)
+            {
+                usage();
+            }
+        }
+        else if (arg == "--threads")
+            opts.threads = std::max(1, parse_int(next));
+        else if (arg == "--structures")
+        {
+            std::stringstream ss(next);
+            std::string name;
+            while (std::getline(ss, name, ','))
+                opts.structures.push_back(name);
+        }
+        else
+            usage();
+    }
+    return opts;
+}
+
+std::vector<Structure> selected_structures(const Options &opts)
+{
+    std::vector<Structure> selected;
+    for (const auto &s : structures())
+        if (opts.structures.empty() || std::find(opts.structures.begin(), opts.structures.end(), s.name) != opts.structures.end())
+            selected.push_back(s);
+    return selected;
+}
+
+std::vector<Result> benchmark_maps(const Options &opts)
+{
+    auto selected = selected_structures(opts);
+
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
     std::vector<int> rev(keys.rbegin(), keys.rend());
-    benchmark_datastructures(keys, "reversed data");
+    std::vector<int> shuffled(keys);
+    std::mt19937 rng(opts.seed);
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+    std::vector<Result> results;
+    for (const auto &[order, data] : {std::make_pair("ordered", &keys),
+                                      std::make_pair("reversed", &rev),
+                                      std::make_pair("shuffled", &shuffled)})
+    {
+        auto w = make_workload(*data, rng);
+        for (const auto &s : selected)
+        {
+            auto r = benchmark(s, w, opts, order);
+            results.insert(results.end(), r.begin(), r.end());
+        }
+    }
+    return results;
+}
 
-    unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
-    std::shuffle(keys.begin(), keys.end(), std::default_random_engine(seed));
-    benchmark_datastructures(keys, "shuffled data");
+// The same shuffled workload through virtual and through static dispatch,
+// the difference is the cost of the indirect call and the lost inlining
+std::vector<Result> benchmark_dispatch(const Options &opts)
+{
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
+    std::mt19937 rng(opts.seed);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    auto w = make_workload(keys, rng);
+
+    std::vector<Result> results;
+    for (auto direct : {false, true})
+    {
+        for (const auto &s : selected_structures(opts))
+        {
+            auto r = benchmark(s, w, opts, direct ? "static" : "virtual", direct);
+            results.insert(results.end(), r.begin(), r.end());
+        }
+    }
+    return results;
+}
 
-    return 0; 
-}
\ No newline at end of file
+// Lower bound over the sorted keys with the same narrowing as
+// sorted_lower_bound but a scalar count in the final window
+int scalar_lower_bound(const int *keys, int n, int key)
+{
+    auto base = keys;
+    while (n > 64)
+    {
+        auto half = n / 2;
+        base = base[half - 1] < key ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + count_less_scalar(base, n, key);
+}
+
+std::vector<Result> benchmark_search(const Options &opts)
+{
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
+    std::vector<int> queries(keys);
+    std::mt19937 rng(opts.seed);
+    std::shuffle(queries.begin(), queries.end(), rng);
+    std::vector<std::pair<int, std::string>> items;
+    for (auto k : keys)
+        items.emplace_back(k, std::to_string(k));
+    BST<std::string> bst;
+    bst.bulk_load(items);
+    SkipList<std::string> skip;
+    skip.bulk_load(items, true);
+    Treap<std::string> treap;
+    treap.bulk_load(items, true);
+    std::map<int, std::string> std_map(items.begin(), items.end());
+    auto eytzinger = EytzingerMap<std::string>::from(bst);
+    BPlusTree<std::string> bplus;
+    bplus.bulk_load(items);
+    // wide ids and zero padded decimal ids, both in the same order as keys
+    std::vector<std::pair<std::int64_t, std::string>> wide_items;
+    std::vector<std::pair<std::string, std::string>> string_items;
+    std::vector<std::pair<InlineString<>, std::string>> inline_items;
+    for (const auto &[k, v] : items)
+    {
+        auto digits = std::to_string(k);
+        auto id = std::string(10 - digits.size(), '0') + digits;
+        wide_items.emplace_back(std::int64_t(k) << 32, v);
+        string_items.emplace_back(id, v);
+        inline_items.emplace_back(id, v);
+    }
+    BPlusTree<std::string, std::int64_t> bplus_wide;
+    bplus_wide.bulk_load(wide_items);
+    BPlusTree<std::string, std::string> bplus_string;
+    bplus_string.bulk_load(string_items);
+    BPlusTree<std::string, InlineString<>> bplus_inline;
+    bplus_inline.bulk_load(inline_items);
+    auto n = int(keys.size());
+    const int *data = keys.data();
+
+    // every kernel must land on the query, so the sum of positions is known up front
+    long expected = 0;
+    for (auto q : queries)
+        expected += q / 2;
+    std::vector<std::pair<std::string, std::function<long(int)>>> kernels{
+        {"simd-lower-bound", [&](int q) { return long(sorted_lower_bound(data, n, q)); }},
+        {"scalar-lower-bound", [&](int q) { return long(scalar_lower_bound(data, n, q)); }},
+        {"std-lower-bound", [&](int q) { return long(std::lower_bound(data, data + n, q) - data); }},
+        {"bst-find", [&](int q) { return bst.lookup(q) ? long(q / 2) : 0L; }},
+        {"treap-find", [&](int q) { return treap.lookup(q) ? long(q / 2) : 0L; }},
+        {"skip-list-find", [&](int q) { return skip.lookup(q) ? long(q / 2) : 0L; }},
+        {"std-map-find", [&](int q) { return std_map.find(q) != std_map.end() ? long(q / 2) : 0L; }},
+        {"eytzinger-find", [&](int q) { return eytzinger.lookup(q) ? long(q / 2) : 0L; }},
+        {"b+tree-find", [&](int q) { return bplus.lookup(q) ? long(q / 2) : 0L; }},
+        {"b+tree-find-int64", [&](int q) { return bplus_wide.lookup(std::int64_t(q) << 32) ? long(q / 2) : 0L; }},
+        {"b+tree-find-inline-string", [&](int q) { return bplus_inline.lookup(inline_items[q / 2].first) ? long(q / 2) : 0L; }},
+        {"b+tree-find-string", [&](int q) { return bplus_string.lookup(string_items[q / 2].first) ? long(q / 2) : 0L; }},
+    };
+
+    // find_many takes the queries in blocks, each block is run when the
+    // timing loop reaches its first query so a sample of the default 256
+    // queries times four whole blocks
+    const int block = 64;
+    std::vector<int> part;
+    std::vector<std::string *> out;
+    auto find_many = [&](auto &map) {
+        return [&](int i) {
+            if (i % block != 0)
+                return 0L;
+            part.assign(queries.begin() + i, queries.begin() + std::min(n, i + block));
+            map.find_many(part, out);
+            long sum = 0;
+            for (std::size_t j = 0; j < part.size(); j++)
+                sum += out[j] ? part[j] / 2 : 0;
+            return sum;
+        };
+    };
+    std::vector<std::pair<std::string, std::function<long(int)>>> batched{
+        {"bst-find-many", find_many(bst)},
+        {"treap-find-many", find_many(treap)},
+        {"skip-list-find-many", find_many(skip)},
+    };
+
+    std::vector<Result> results;
+    auto measure = [&](const std::string &name, const std::function<long(int)> &op) {
+        if (!opts.structures.empty() && std::find(opts.structures.begin(), opts.structures.end(), name) == opts.structures.end())
+            return;
+        std::vector<double> samples;
+        for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+        {
+            std::vector<double> rep_samples;
+            long sum = 0;
+            timed(n, opts.sample, rep_samples, [&](int i) { sum += op(i); });
+            if (sum != expected)
+                std::cerr << name << ": wrong lower bound" << std::endl;
+            if (rep >= opts.warmup)
+                samples.insert(samples.end(), rep_samples.begin(), rep_samples.end());
+        }
+        auto r = summarise(samples, long(opts.reps) * n);
+        r.order = "search";
+        r.structure = name;
+        r.operation = "find-hit";
+        results.push_back(r);
+    };
+    for (const auto &[name, kernel] : kernels)
+        measure(name, [&](int i) { return kernel(queries[i]); });
+    for (const auto &[name, op] : batched)
+        measure(name, op);
+    return results;
+}
+
+// Insert and find timings next to what each structure holds once built
+std::vector<Result> benchmark_memory(const Options &opts)
+{
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
+    std::mt19937 rng(opts.seed);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    auto w = make_workload(keys, rng);
+    auto n = int(keys.size());
+
+    std::vector<Result> results;
+    for (const auto &s : selected_structures(opts))
+    {
+        std::vector<double> inserts, finds;
+        MemoryUsage memory;
+        long hits = 0;
+        for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+        {
+            std::vector<double> rep_inserts, rep_finds;
+            auto ds = s.make();
+            timed(n, opts.sample, rep_inserts, [&](int i) { ds->insert(w.keys[i], w.values[i]); });
+            timed(n, opts.sample, rep_finds, [&](int i) { hits += ds->lookup(w.keys[i]) != nullptr; });
+            memory = ds->memory_usage();
+            if (rep < opts.warmup)
+                continue;
+            inserts.insert(inserts.end(), rep_inserts.begin(), rep_inserts.end());
+            finds.insert(finds.end(), rep_finds.begin(), rep_finds.end());
+        }
+        if (hits != long(opts.warmup + opts.reps) * n)
+            std::cerr << s.name << ": keys missing" << std::endl;
+        for (auto [operation, samples] : {std::make_pair("insert", &inserts), std::make_pair("find-hit", &finds)})
+        {
+            auto r = summarise(*samples, long(opts.reps) * n);
+            r.order = "memory";
+            r.structure = s.name;
+            r.operation = operation;
+            results.push_back(r);
+        }
+        Result r;
+        r.order = "memory";
+        r.structure = s.name;
+        r.operation = "memory";
+        r.memory = memory;
+        results.push_back(r);
+    }
+    return results;
+}
+
+// One pass of inserts, finds and erases per key order, the shape is taken
+// after the inserts and the counters are reset before each phase so every
+// row counts its own operations
+std::vector<Result> benchmark_shape(const Options &opts)
+{
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
+    std::vector<int> rev(keys.rbegin(), keys.rend());
+    std::vector<int> shuffled(keys);
+    std::mt19937 rng(opts.seed);
+    std::shuffle(shuffled.begin(), shuffled.end(), rng);
+
+    std::vector<Result> results;
+    for (const auto &[order, data] : {std::make_pair("ordered", &keys),
+                                      std::make_pair("reversed", &rev),
+                                      std::make_pair("shuffled", &shuffled)})
+    {
+        auto w = make_workload(*data, rng);
+        auto n = int(w.keys.size());
+        for (const auto &s : selected_structures(opts))
+        {
+            auto ds = s.make();
+            long hits = 0;
+            auto phase = [&](const char *operation, auto op) {
+                std::vector<double> samples;
+                ds->reset_counters();
+                timed(n, opts.sample, samples, op);
+                auto r = summarise(samples, n);
+                r.order = order;
+                r.structure = s.name;
+                r.operation = operation;
+                r.shaped = true;
+                r.shape = ds->shape_stats();
+                return r;
+            };
+            auto inserts = phase("insert", [&](int i) { ds->insert(w.keys[i], w.values[i]); });
+            auto finds = phase("find-hit", [&](int i) { hits += ds->lookup(w.keys[i]) != nullptr; });
+            auto erases = phase("erase", [&](int i) { ds->erase(w.keys[i]); });
+            // the finds and erases are reported against the tree they started on
+            for (auto r : {&finds, &erases})
+            {
+                r->shape.height = inserts.shape.height;
+                r->shape.mean_depth = inserts.shape.mean_depth;
+                r->shape.levels = inserts.shape.levels;
+            }
+            results.insert(results.end(), {inserts, finds, erases});
+            if (hits != n)
+                std::cerr << s.name << ": keys missing on " << order << " data" << std::endl;
+        }
+    }
+    return results;
+}
+
+// Times nothing: builds the skip list and treap in parallel, so their nodes
+// sit in pools their own allocator adopted, then erases every other key,
+// inserts the gaps and tears both down. Runs are only split with at least
+// 2^14 keys per hardware thread. Returns false on a wrong result
+bool check_parallel_builds(const Options &opts)
+{
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 0; i < opts.size; i++)
+        items.emplace_back(2 * i, std::to_string(2 * i));
+    bool ok = true;
+    auto check = [&](auto &map, const std::string &name) {
+        map.bulk_load(items, true);
+        for (int i = 0; i < opts.size; i += 2)
+            map.erase(2 * i);
+        for (int i = 0; i < opts.size; i++)
+            map.insert(2 * i + 1, std::to_string(2 * i + 1));
+        std::string value;
+        for (int i = 0; i < opts.size; i++)
+        {
+            auto kept = map.find(2 * i, value) && value == items[i].second;
+            auto added = map.find(2 * i + 1, value) && value == std::to_string(2 * i + 1);
+            if (kept != (i % 2 == 1) || !added)
+            {
+                std::cerr << name << ": wrong contents after erasing from a parallel build" << std::endl;
+                ok = false;
+                return;
+            }
+        }
+        if (map.size() != opts.size + opts.size / 2)
+        {
+            std::cerr << name << ": wrong size after erasing from a parallel build" << std::endl;
+            ok = false;
+        }
+    };
+    {
+        SkipList<std::string> skip;
+        check(skip, "skip-list");
+    }
+    {
+        Treap<std::string> treap;
+        check(treap, "treap");
+    }
+    return ok;
+}
+
+// Rebuild by insert against a snapshot round trip, each as nanoseconds per key
+std::vector<Result> benchmark_snapshot(const Options &opts)
+{
+    std::vector<int> keys(opts.size);
+    for (int i = 0; i < opts.size; i++)
+        keys[i] = 2 * i;
+    std::mt19937 rng(opts.seed);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    auto w = make_workload(keys, rng);
+    auto n = int(keys.size());
+    auto path = (std::filesystem::temp_directory_path() / "benchmark.snapshot").string();
+    auto per_key = [&](Clock::time_point start, Clock::time_point stop) {
+        return std::chrono::duration<double, std::nano>(stop - start).count() / std::max(1, n);
+    };
+
+    std::vector<Result> results;
+    auto add = [&](const std::string &structure, const std::string &operation, const std::vector<double> &samples, long ops) {
+        auto r = summarise(samples, ops);
+        r.order = "snapshot";
+        r.structure = structure;
+        r.operation = operation;
+        results.push_back(r);
+    };
+    for (const auto &s : selected_structures(opts))
+    {
+        std::vector<double> rebuild, save, load;
+        long missing = 0;
+        for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+        {
+            std::vector<double> rep_rebuild;
+            auto ds = s.make();
+            timed(n, opts.sample, rep_rebuild, [&](int i) { ds->insert(w.keys[i], w.values[i]); });
+            auto start = Clock::now();
+            s.save(*ds, path);
+            auto saved = Clock::now();
+            auto restored = s.make();
+            auto before = Clock::now();
+            s.load(*restored, path);
+            auto loaded = Clock::now();
+            for (auto k : w.keys)
+                missing += restored->lookup(k) == nullptr;
+            if (rep < opts.warmup)
+                continue;
+            rebuild.insert(rebuild.end(), rep_rebuild.begin(), rep_rebuild.end());
+            save.push_back(per_key(start, saved));
+            load.push_back(per_key(before, loaded));
+        }
+        if (missing != 0)
+            std::cerr << s.name << ": keys missing after loading a snapshot" << std::endl;
+        add(s.name, "rebuild", rebuild, long(opts.reps) * n);
+        add(s.name, "save", save, long(opts.reps) * n);
+        add(s.name, "load", load, long(opts.reps) * n);
+    }
+
+    SortedArrayMap<int> values;
+    for (auto k : keys)
+        values.insert(k, k);
+    save_snapshot(values, path);
+    std::vector<double> open, finds;
+    long sum = 0;
+    for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+    {
+        auto start = Clock::now();
+        MappedSnapshot<int> mapped(path);
+        auto opened = Clock::now();
+        std::vector<double> rep_finds;
+        timed(n, opts.sample, rep_finds, [&](int i) { sum += *mapped.lookup(w.keys[i]); });
+        if (rep < opts.warmup)
+            continue;
+        open.push_back(std::chrono::duration<double, std::nano>(opened - start).count());
+        finds.insert(finds.end(), rep_finds.begin(), rep_finds.end());
+    }
+    sink = sum;
+    add("mapped-snapshot", "open", open, opts.reps);
+    add("mapped-snapshot", "find-hit", finds, long(opts.reps) * n);
+    std::remove(path.c_str());
+    return results;
+}
+
+// Only made and shared between threads, so without the single threaded
+// hooks of Structure
+struct ConcurrentStructure
+{
+    std::string name;
+    std::function<std::unique_ptr<Map<std::string>>()> make;
+};
+
+std::vector<ConcurrentStructure> concurrent_structures()
+{
+    return {
+        {"concurrent-skip-list", [] { return std::make_unique<ConcurrentSkipList<std::string>>(); }},
+        {"locked-std-map", [] { return std::make_unique<LockedStdMap<std::string>>(); }},
+        {"sharded-linked-list", [] { return std::make_unique<ShardedMap<LinkedList<std::string>>>(); }},
+        {"sharded-skip-list", [] { return std::make_unique<ShardedMap<SkipList<std::string>>>(); }},
+        {"sharded-bst", [] { return std::make_unique<ShardedMap<BST<std::string>>>(); }},
+        {"sharded-treap", [] { return std::make_unique<ShardedMap<Treap<std::string>>>(); }},
+        {"sharded-avl", [] { return std::make_unique<ShardedMap<AVLTree<std::string>>>(); }},
+        {"sharded-b+tree", [] { return std::make_unique<ShardedMap<BPlusTree<std::string>>>(); }},
+        {"sharded-std-map", [] { return std::make_unique<ShardedMap<StdMap<std::string>>>(); }},
+    };
+}
+
+// Every thread runs its own stream of ops against one shared structure holding
+// the even keys, writes insert and erase odd keys so its size stays level
+std::vector<Result> benchmark_concurrent(const Options &opts)
+{
+    std::vector<int> thread_counts;
+    for (int t = 1; t < opts.threads; t *= 2)
+        thread_counts.push_back(t);
+    thread_counts.push_back(opts.threads);
+    std::vector<std::pair<int, std::string>> items;
+    for (int i = 0; i < opts.size; i++)
+        items.emplace_back(2 * i, std::to_string(2 * i));
+
+    std::vector<Result> results;
+    for (auto threads : thread_counts)
+    {
+        for (auto reads : {50, 90, 99})
+        {
+            std::mt19937 rng(opts.seed);
+            std::uniform_int_distribution<int> pick(0, std::max(0, opts.size - 1));
+            std::uniform_int_distribution<int> percent(0, 99);
+            std::vector<std::vector<Op>> streams(threads);
+            for (auto &ops : streams)
+                for (int i = 0; i < opts.size; i++)
+                {
+                    auto key = 2 * pick(rng), p = percent(rng);
+                    if (p < reads)
+                        ops.push_back({Op::Find, key});
+                    else
+                        ops.push_back({p % 2 ? Op::Insert : Op::Erase, key + 1});
+                }
+
+            for (const auto &s : concurrent_structures())
+            {
+                if (!opts.structures.empty() && std::find(opts.structures.begin(), opts.structures.end(), s.name) == opts.structures.end())
+                    continue;
+                std::vector<double> samples;
+                double wall = 0;
+                long missing = 0;
+                for (int rep = 0; rep < opts.warmup + opts.reps; rep++)
+                {
+                    auto ds = s.make();
+                    ds->bulk_load(items);
+                    std::vector<std::vector<double>> thread_samples(threads);
+                    std::atomic<int> ready{0};
+                    std::atomic<long> misses{0};
+                    std::vector<std::thread> pool;
+                    auto start = Clock::now();
+                    for (int t = 0; t < threads; t++)
+                        pool.emplace_back([&, t] {
+                            std::string value = "v";
+                            long lost = 0;
+                            ready.fetch_add(1);
+                            while (ready.load() < threads)
+                                std::this_thread::yield();
+                            const auto &ops = streams[t];
+                            timed(ops.size(), opts.sample, thread_samples[t], [&](int i) {
+                                const auto &op = ops[i];
+                                if (op.kind == Op::Find)
+                                    lost += !ds->find(op.key, value);
+                                else if (op.kind == Op::Insert)
+                                    ds->insert(op.key, value);
+                                else
+                                    ds->erase(op.key);
+                            });
+                            misses += lost;
+                        });
+                    for (auto &th : pool)
+                        th.join();
+                    auto elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+                    // the even keys are never written, so every find must hit
+                    missing += misses;
+                    if (rep < opts.warmup)
+                        continue;
+                    wall += elapsed;
+                    for (const auto &ts : thread_samples)
+                        samples.insert(samples.end(), ts.begin(), ts.end());
+                }
+                if (missing != 0)
+                    std::cerr << s.name << ": keys missing with " << threads << " threads" << std::endl;
+                auto ops = long(opts.reps) * threads * opts.size;
+                auto r = summarise(samples, ops);
+                r.order = "threads-" + std::to_string(threads);
+                r.structure = s.name;
+                r.operation = "mixed-r" + std::to_string(reads);
+                r.throughput = wall > 0 ? ops / wall * 1000 : 0;
+                results.push_back(r);
+            }
+        }
+    }
+    return results;
+}
+
+int main(int argc, char **argv)
+{
+    auto opts = parse(argc, argv);
+    if (opts.mode == "check")
+        return check_parallel_builds(opts) ? 0 : 1;
+    std::vector<Result> results;
+    if (opts.mode == "search")
+        results = benchmark_search(opts);
+    else if (opts.mode == "dispatch")
+        results = benchmark_dispatch(opts);
+    else if (opts.mode == "concurrent")
+        results = benchmark_concurrent(opts);
+    else if (opts.mode == "snapshot")
+        results = benchmark_snapshot(opts);
+    else if (opts.mode == "memory")
+        results = benchmark_memory(opts);
+    else if (opts.mode == "shape")
+        results = benchmark_shape(opts);
+    else
+        results = benchmark_maps(opts);
+
+    if (opts.format == "csv")
+        print_csv(results);
+    else if (opts.format == "json")
+        print_json(results, opts);
+    else
+        print_text(results);
+    return 0;
+}
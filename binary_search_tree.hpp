@@ -6,87 +6,318 @@
     Written by Dylan Janssen 
     Developed as a teaching execise
     Separate Node struct so we can inherit BST for treap class 
+    Nodes come from alloc_T, see node_pool.hpp 
+    Every node counts the nodes in its subtree, which gives rank and 
+    select in one walk down the tree 
+    shape_stats() gives the height and depth print() draws, as numbers 
+    Inserts and erases keep the node of the last one as a finger and climb 
+    from it by parent pointers to the lowest subtree that can hold the 
+    next key, so keys near the last one take O(log d) steps to find in a 
+    balanced tree. The subtree sizes above a new node still cost a walk to 
+    the root, O(depth) per insert: O(log n) when balanced but O(n) for 
+    in order appends to a plain BST, whose tree is then a path. Readers 
+    keep their own Finger for lookup(key, finger) 
+    find_many runs a batch of searches in lockstep, see lockstep.hpp 
+    for_each and reduce can split the keys by rank over one thread per 
+    core, and clear can tear subtrees down on them, see fork_join.hpp 
 */
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
+#include <iterator>
 #include <string>
 #include <vector>
-#include "map.hpp" 
+#include "ordered_map.hpp"
+#include "node_pool.hpp"
+#include "lockstep.hpp"
+#include "fork_join.hpp"
 
-template <typename T>
+template <typename T, typename Key = int>
 struct Node
 {
-    int key;
+    Key key;
     T value;
-    Node *left, *right;
-    Node(int k, const T &v) : key(k), value(v), left(nullptr), right(nullptr) {}
+    Node *left, *right, *parent;
+    int size; // nodes in the subtree, node_T for any BST needs one
+    template <typename... Args>
+    Node(const Key &k, Args &&...args) : key(k), value(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent(nullptr), size(1) {}
 };
 
-template <typename T, typename node_T = Node<T>>
-class BST : public Map<T>
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename node_T = Node<T, Key>, typename alloc_T = PoolAllocator>
+class BST : public OrderedMap<T, Key, Compare>
 {
 protected:
+    using order = KeyOrder<Key, Compare>;
     node_T *root;
-    std::vector<std::string> traversals{"Preorder", "Inorder", "Postorder"};
+    alloc_T alloc;
+    mutable ShapeCounters counters;
+    node_T *finger; // the node of the last insert or erase, or one near it
+    std::uint64_t frees; // nodes freed so far, a reader's Finger is stale once this moves
+    static constexpr const char *traversals[] = {"Preorder", "Inorder", "Postorder"};
+    static constexpr int find_group = 8; // searches find_many keeps in flight
 
-    void insert(node_T *&node, int key, const T &value);
-    void erase(node_T *&node, int key);
-    bool find(node_T *node, int key, T &value);
+    template <typename... Args>
+    std::pair<node_T *, bool> emplace_leaf(const Key &key, Args &&...args);
+    node_T *find_node(const Key &key, node_T *start) const;
+    node_T *find_node(const Key &key) const { return find_node(key, root); }
+    node_T *climb(node_T *node, const Key &key) const;
+    node_T *resume(const Key &key) const { return finger == nullptr ? root : climb(finger, key); }
+    void free_node(node_T *node);
+    node_T *&link(node_T *node);
+    void replace(node_T *node, node_T *child);
+    node_T *unlink_node(node_T *node);
+    node_T *splice_successor(node_T *node);
     void rotate_left(node_T *&node);
     void rotate_right(node_T *&node);
     void deleteTree(node_T *node);
+    template <typename Free>
+    static void dismantle(node_T *node, Free free);
     node_T *successor(node_T *node);
-    void traverse(node_T *node, int type);
-    void print(const std::string &prefix, node_T *node, bool is_right);
+    node_T *next_node(node_T *node) const;
+    node_T *prev_node(node_T *node) const;
+    node_T *bound_node(const Key &key, bool inclusive) const;
+    node_T *build(const std::vector<std::pair<Key, T>> &items, int lo, int hi, node_T *parent);
+    node_T *select_node(int k) const;
+    static int subtree_size(const node_T *node) { return node == nullptr ? 0 : node->size; }
+    static void update_size(node_T *node) { node->size = 1 + subtree_size(node->left) + subtree_size(node->right); }
 
 public:
-    BST() : root(nullptr) {}
-    void insert(int key, const T &value) override { insert(root, key, value); }
-    void erase(int key) override { erase(root, key); }
-    bool find(int key, T &value) override { return find(root, key, value); }
+    using Visitor = typename OrderedMap<T, Key, Compare>::Visitor;
+    BST() : root(nullptr), finger(nullptr), frees(0) {}
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args)
+    {
+        auto [node, inserted] = emplace_leaf(key, std::forward<Args>(args)...);
+        return {&node->value, inserted};
+    }
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    // The last node a reader's lookup reached. A lookup with it climbs from
+    // there, and it falls back to the root once nodes have been freed
+    class Finger
+    {
+    private:
+        node_T *node = nullptr;
+        std::uint64_t frees = 0;
+        friend class BST;
+    };
+    T *lookup(const Key &key, Finger &finger);
+    // lookup(keys[i]) into out[i] for every key with find_group searches
+    // in flight at once, returns the number found
+    int find_many(const std::vector<Key> &keys, std::vector<T *> &out);
+    int find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found) override { return find_batch_by_many(*this, keys, values, found); }
+    void clear() override;
+    // parallel tears the subtrees down on one thread each
+    void clear(bool parallel);
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    void range(const Key &lo, const Key &hi, Visitor visit) const override;
+    void for_each(Visitor visit) const override;
+    // parallel visits a run of keys per thread, each run in order but the
+    // runs at once, so visit must be safe to call from several threads
+    template <typename Visit>
+    void for_each(Visit visit, bool parallel) const;
+    // Folds get(key, value) over the keys in order with combine, which
+    // must be associative, parallel as for for_each
+    template <typename R, typename Get, typename Combine>
+    R reduce(const R &identity, Get get, Combine combine, bool parallel = false) const;
+    bool lower_bound(const Key &key, Key &found, T &value) const override;
+    bool upper_bound(const Key &key, Key &found, T &value) const override;
+    int rank(const Key &key) const override;
+    bool select(int k, Key &found, T &value) const override;
+    int size() const { return subtree_size(root); }
+    MemoryUsage memory_usage() const override;
+    ShapeStats shape_stats() const override;
+    void reset_counters() override { counters.reset(); }
     void traverse(int type); // 0=preorder, 1=inorder, 2=postorder
-    void print() { print("", root, false); }
+    void print();
     ~BST();
+
+    // In order iterator, steps follow parent pointers so a full walk is O(n)
+    class Iterator
+    {
+    private:
+        node_T *node;
+        const BST *tree; // end() is nullptr, decrementing it needs the root
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = OrderedEntry<T, Key>;
+        Iterator(node_T *n, const BST *t) : node(n), tree(t) {}
+        Iterator &operator++()
+        {
+            node = tree->next_node(node);
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+        Iterator &operator--()
+        {
+            node = tree->prev_node(node);
+            return *this;
+        }
+        Iterator operator--(int)
+        {
+            auto temp = *this;
+            --*this;
+            return temp;
+        }
+        reference operator*() const { return reference(node->key, node->value); }
+        bool operator==(const Iterator &rhs) const { return node == rhs.node; }
+        bool operator!=(const Iterator &rhs) const { return node != rhs.node; }
+    };
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const { return Iterator(root == nullptr ? nullptr : next_node(nullptr), this); }
+    Iterator end() const { return Iterator(nullptr, this); }
+    ReverseIterator rbegin() const { return ReverseIterator(end()); }
+    ReverseIterator rend() const { return ReverseIterator(begin()); }
+    Iterator lower_bound(const Key &key) const { return Iterator(bound_node(key, true), this); }
+    Iterator upper_bound(const Key &key) const { return Iterator(bound_node(key, false), this); }
+    Iterator select(int k) const { return Iterator(select_node(k), this); }
 };
 
+/*
+    Every operation below is a loop rather than a recursion, an unbalanced
+    tree fed sorted keys is a list n nodes deep and would overflow the stack.
+    Nodes keep a pointer to their parent so a walk can climb back up.
+*/
 
+// Same layout as the recursive version, right subtrees above left ones
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::print()
+{
+    struct Frame
+    {
+        std::string prefix;
+        node_T *node;
+        bool is_right;
+    };
+    std::vector<Frame> stack{{"", root, false}};
+    while (!stack.empty())
+    {
+        auto [prefix, node, is_right] = std::move(stack.back());
+        stack.pop_back();
+        if (node == nullptr)
+        {
+            std::cout << prefix << (is_right ? " ├───X" : " └───X") << std::endl;
+            continue;
+        }
+        std::cout << prefix;
+        std::cout << (is_right ? " ├── " : " └── ");
+        std::cout << node->key << std::endl;
+        auto child_prefix = prefix + (is_right ? " │  " : "    ");
+        stack.push_back({child_prefix, node->left, false});
+        stack.push_back({child_prefix, node->right, true});
+    }
+}
 
-template <typename T, typename node_T>
-void BST<T, node_T>::print(const std::string &prefix, node_T *node, bool is_right)
+// Links a new leaf built from args, or returns the node already holding
+// key untouched. The bool is true for a new leaf
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename... Args>
+std::pair<node_T *, bool> BST<T, Key, Compare, node_T, alloc_T>::emplace_leaf(const Key &key, Args &&...args)
 {
-    if (node == nullptr)
+    auto probe = counters.probe();
+    auto start = resume(key);
+    auto parent = start == nullptr ? nullptr : start->parent;
+    auto child = start == nullptr ? &root : &link(start);
+    while (*child != nullptr)
     {
-        std::cout << prefix << (is_right ? " ├───X" : " └───X") << std::endl;
-        return;
+        parent = *child;
+        probe.step();
+        probe.compare();
+        auto c = order::compare(key, parent->key);
+        if (c == 0)
+        {
+            finger = parent;
+            return {parent, false};
+        }
+        child = c < 0 ? &parent->left : &parent->right;
     }
-    std::cout << prefix;
-    std::cout << (is_right ? " ├── " : " └── ");
-    std::cout << node->key << std::endl;
-    print(prefix + (is_right ? " │  " : "    "), node->right, true);
-    print(prefix + (is_right ? " │  " : "    "), node->left, false);
+    *child = create_node<node_T>(alloc, key, std::forward<Args>(args)...);
+    (*child)->parent = parent;
+    finger = *child;
+    counters.update();
+    // O(depth) however short the search from the finger was
+    for (; parent != nullptr; parent = parent->parent)
+        parent->size++;
+    return {*child, true};
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::insert(node_T *&node, int key, const T &value)
+// Climbs from node to the lowest ancestor whose subtree spans key. Every
+// ancestor spans node's key, so only the bound on key's side is in doubt:
+// the first ancestor node hangs off the far side of, going up
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::climb(node_T *node, const Key &key) const
 {
-    if (node == nullptr) // make a new node
-        node = new node_T(key, value);
-    else
+    auto c = order::compare(key, node->key);
+    if (c == 0)
+        return node;
+    while (node->parent != nullptr)
     {
-        if (node->key == key)
+        auto parent = node->parent;
+        if ((c < 0) == (parent->right == node)) // parent bounds node's subtree on key's side
         {
-            node->value = value;
-            return;
+            auto d = order::compare(key, parent->key);
+            if (d == 0)
+                return parent;
+            if ((d < 0) != (c < 0))
+                return node;
         }
-        if (key < node->key)
-            insert(node->left, key, value);
-        else
-            insert(node->right, key, value);
+        node = parent;
     }
+    return node;
 }
 
-template <typename T, typename node_T>
-node_T *BST<T, node_T>::successor(node_T *node)
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::find_node(const Key &key, node_T *start) const
+{
+    auto probe = counters.probe();
+    auto node = start;
+    while (node != nullptr)
+    {
+        probe.step();
+        probe.compare();
+        auto c = order::compare(key, node->key);
+        if (c == 0)
+            break;
+        node = c < 0 ? node->left : node->right;
+    }
+    return node;
+}
+
+// The pointer that holds node, either root or a child pointer of its parent
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *&BST<T, Key, Compare, node_T, alloc_T>::link(node_T *node)
+{
+    if (node->parent == nullptr)
+        return root;
+    return node->parent->left == node ? node->parent->left : node->parent->right;
+}
+
+// Puts child (which may be null) where node was
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::replace(node_T *node, node_T *child)
+{
+    link(node) = child;
+    if (child != nullptr)
+        child->parent = node->parent;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::successor(node_T *node)
 {
     auto curr = node->right;
     while (curr->left != nullptr)
@@ -94,110 +325,515 @@ node_T *BST<T, node_T>::successor(node_T *node)
     return curr;
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::erase(node_T *&node, int key)
+// The in order successor, nullptr (the end) wraps round to the smallest node
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::next_node(node_T *node) const
 {
-    if (node == nullptr)
-        return;
-    if (key > node->key)
-        erase(node->right, key);
-    else if (key < node->key)
-        erase(node->left, key);
-    else
+    if (node == nullptr || node->right != nullptr)
+    {
+        node = node == nullptr ? root : node->right;
+        while (node->left != nullptr)
+            node = node->left;
+        return node;
+    }
+    while (node->parent != nullptr && node->parent->right == node)
+        node = node->parent;
+    return node->parent;
+}
+
+// The in order predecessor, nullptr (the end) steps back to the largest node
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::prev_node(node_T *node) const
+{
+    if (node == nullptr || node->left != nullptr)
+    {
+        node = node == nullptr ? root : node->left;
+        while (node->right != nullptr)
+            node = node->right;
+        return node;
+    }
+    while (node->parent != nullptr && node->parent->left == node)
+        node = node->parent;
+    return node->parent;
+}
+
+// The first node with a key >= key when inclusive, > key otherwise
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::bound_node(const Key &key, bool inclusive) const
+{
+    node_T *bound = nullptr;
+    auto node = root;
+    while (node != nullptr)
     {
-        if (node->left == nullptr && node->right == nullptr)
+        if (inclusive ? !order::less(node->key, key) : order::less(key, node->key))
         {
-            delete node;
-            node = nullptr;
+            bound = node;
+            node = node->left;
         }
-        else if (node->left == nullptr || node->right == nullptr)
+        else
+            node = node->right;
+    }
+    return bound;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::range(const Key &lo, const Key &hi, Visitor visit) const
+{
+    for (auto node = bound_node(lo, true); node != nullptr && order::less(node->key, hi); node = next_node(node))
+        visit(node->key, node->value);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::for_each(Visitor visit) const
+{
+    for (const auto &[key, value] : *this)
+        visit(key, value);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename Visit>
+void BST<T, Key, Compare, node_T, alloc_T>::for_each(Visit visit, bool parallel) const
+{
+    auto n = size();
+    walk_pieces(
+        n, parallel_pieces(n, parallel), [this](int k) { return select_node(k); }, [this](node_T *x) { return next_node(x); },
+        [&](int, node_T *x) { visit(x->key, x->value); });
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename R, typename Get, typename Combine>
+R BST<T, Key, Compare, node_T, alloc_T>::reduce(const R &identity, Get get, Combine combine, bool parallel) const
+{
+    auto n = size();
+    return reduce_pieces(
+        n, parallel_pieces(n, parallel), identity, [this](int k) { return select_node(k); }, [this](node_T *x) { return next_node(x); },
+        [&](node_T *x) { return get(x->key, x->value); }, combine);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+bool BST<T, Key, Compare, node_T, alloc_T>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto node = bound_node(key, true);
+    if (node == nullptr)
+        return false;
+    found = node->key;
+    value = node->value;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+bool BST<T, Key, Compare, node_T, alloc_T>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto node = bound_node(key, false);
+    if (node == nullptr)
+        return false;
+    found = node->key;
+    value = node->value;
+    return true;
+}
+
+// Counts the left subtrees and nodes passed on the way down
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+int BST<T, Key, Compare, node_T, alloc_T>::rank(const Key &key) const
+{
+    auto count = 0;
+    auto node = root;
+    while (node != nullptr)
+    {
+        if (order::less(node->key, key))
         {
-            auto temp = node;
-            node = (node->left == nullptr) ? node->right : node->left;
-            delete temp;
+            count += subtree_size(node->left) + 1;
+            node = node->right;
         }
+        else
+            node = node->left;
+    }
+    return count;
+}
+
+// The node with k nodes before it, nullptr (the end) when there are k or fewer
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::select_node(int k) const
+{
+    if (k < 0)
+        return nullptr;
+    auto node = root;
+    while (node != nullptr)
+    {
+        auto left = subtree_size(node->left);
+        if (k == left)
+            break;
+        if (k < left)
+            node = node->left;
         else
         {
-            auto *succ = successor(node);
-            node->key = succ->key;
-            node->value = succ->value;
-            erase(node->right, succ->key);
+            k -= left + 1;
+            node = node->right;
         }
     }
+    return node;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+bool BST<T, Key, Compare, node_T, alloc_T>::select(int k, Key &found, T &value) const
+{
+    auto node = select_node(k);
+    if (node == nullptr)
+        return false;
+    found = node->key;
+    value = node->value;
+    return true;
+}
+
+// A node with two children is replaced by its successor node rather than
+// copying the successor's key and value, so nodes never change contents
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::erase(const Key &key)
+{
+    auto node = find_node(key, resume(key));
+    if (node == nullptr)
+        return;
+    finger = unlink_node(node);
+    free_node(node);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::free_node(node_T *node)
+{
+    destroy_node(alloc, node);
+    frees++;
+}
+
+// Takes node out of the tree, splicing in its successor when it has two
+// children, and takes it off the sizes above. Returns the lowest node whose
+// subtree lost a node, nullptr when that is the whole tree
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::unlink_node(node_T *node)
+{
+    node_T *lowest;
+    if (node->left == nullptr || node->right == nullptr)
+    {
+        replace(node, node->left == nullptr ? node->right : node->left);
+        lowest = node->parent;
+    }
+    else
+        lowest = splice_successor(node);
+    for (auto above = lowest; above != nullptr; above = above->parent)
+        above->size--;
+    counters.update();
+    return lowest;
+}
+
+// Puts node's successor in node's place, returns the lowest changed node
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::splice_successor(node_T *node)
+{
+    auto succ = successor(node);
+    succ->size = node->size;
+    auto lowest = succ;
+    if (succ->parent != node)
+    {
+        lowest = succ->parent;
+        replace(succ, succ->right);
+        succ->right = node->right;
+        succ->right->parent = succ;
+    }
+    replace(node, succ);
+    succ->left = node->left;
+    succ->left->parent = succ;
+    return lowest;
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::rotate_left(node_T *&node)
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::rotate_left(node_T *&node)
 {
     auto temp = node->right;
     node->right = temp->left;
+    if (temp->left != nullptr)
+        temp->left->parent = node;
+    temp->parent = node->parent;
     temp->left = node;
+    node->parent = temp;
+    temp->size = node->size;
+    update_size(node);
     node = temp;
+    counters.rotation();
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::rotate_right(node_T *&node)
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::rotate_right(node_T *&node)
 {
     auto temp = node->left;
     node->left = temp->right;
+    if (temp->right != nullptr)
+        temp->right->parent = node;
+    temp->parent = node->parent;
     temp->right = node;
+    node->parent = temp;
+    temp->size = node->size;
+    update_size(node);
     node = temp;
+    counters.rotation();
 }
 
-template <typename T, typename node_T>
-bool BST<T, node_T>::find(node_T *node, int key, T &value)
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+T *BST<T, Key, Compare, node_T, alloc_T>::lookup(const Key &key)
 {
-    if (node == nullptr)
-        return false;
-    if (node->key == key)
+    auto node = find_node(key);
+    return node == nullptr ? nullptr : &node->value;
+}
+
+// Keeps the last node the search reached, found or not, as the new finger
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+T *BST<T, Key, Compare, node_T, alloc_T>::lookup(const Key &key, Finger &f)
+{
+    auto probe = counters.probe();
+    auto node = f.node != nullptr && f.frees == frees ? climb(f.node, key) : root;
+    f.node = nullptr;
+    f.frees = frees;
+    while (node != nullptr)
     {
-        value = node->value;
-        return true;
+        f.node = node;
+        probe.step();
+        probe.compare();
+        auto c = order::compare(key, node->key);
+        if (c == 0)
+            return &node->value;
+        node = c < 0 ? node->left : node->right;
     }
-    if (key < node->key)
-        return find(node->left, key, value);
-    return find(node->right, key, value);
+    return nullptr;
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::traverse(node_T *node, int type)
+// Each step compares one search's key with its node and prefetches the
+// child it moves to, which is not read until every other search in the
+// group has taken its step
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+int BST<T, Key, Compare, node_T, alloc_T>::find_many(const std::vector<Key> &keys, std::vector<T *> &out)
 {
-    if (node == nullptr)
-        return;
-    if (type == 0)
-        std::cout << node->key << ' ';
-    traverse(node->left, type);
-    if (type == 1)
-        std::cout << node->key << ' ';
-    traverse(node->right, type);
-    if (type == 2)
-        std::cout << node->key << ' ';
+    struct Search
+    {
+        node_T *node;
+        std::size_t i;
+        long steps;
+    };
+    out.assign(keys.size(), nullptr);
+    int count = 0;
+    auto start = [&](Search &s, std::size_t i) { s = {root, i, 0}; };
+    auto step = [&](Search &s) {
+        if (s.node != nullptr)
+        {
+            s.steps++;
+            auto c = order::compare(keys[s.i], s.node->key);
+            if (c != 0)
+            {
+                s.node = c < 0 ? s.node->left : s.node->right;
+                prefetch_node(s.node);
+                return false;
+            }
+            out[s.i] = &s.node->value;
+            count++;
+        }
+        auto probe = counters.probe();
+        probe.step(s.steps);
+        probe.compare(s.steps);
+        return true;
+    };
+    in_lockstep<find_group, Search>(keys.size(), start, step);
+    return count;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+MemoryUsage BST<T, Key, Compare, node_T, alloc_T>::memory_usage() const
+{
+    MemoryUsage usage;
+    for (const auto &[key, value] : *this)
+        usage.add_entry(key, value);
+    auto node = alloc.block_size(sizeof(node_T));
+    usage.nodes = size();
+    usage.node_bytes += usage.nodes * (node - sizeof(T));
+    usage.aux_bytes = sizeof(*this) + allocator_slack(alloc, usage.nodes * node);
+    return usage;
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::traverse(int type)
+// Walks the tree like traverse, keeping the depth of the node it is at
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+ShapeStats BST<T, Key, Compare, node_T, alloc_T>::shape_stats() const
+{
+    ShapeStats stats;
+    long total = 0;
+    auto depth = 1;
+    node_T *prev = nullptr, *node = root;
+    while (node != nullptr)
+    {
+        auto from_parent = prev == node->parent;
+        if (from_parent)
+        {
+            total += depth;
+            stats.height = std::max(stats.height, depth);
+            if (node->left != nullptr)
+            {
+                prev = node;
+                node = node->left;
+                depth++;
+                continue;
+            }
+        }
+        if ((from_parent || prev == node->left) && node->right != nullptr)
+        {
+            prev = node;
+            node = node->right;
+            depth++;
+            continue;
+        }
+        prev = node;
+        node = node->parent;
+        depth--;
+    }
+    stats.mean_depth = size() == 0 ? 0 : double(total) / size();
+    counters.report(stats);
+    return stats;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::traverse(int type)
 {
     std::cout << traversals[type] << " : ";
-    traverse(root, type);
+    // prev tells which way the walk arrived at node: from its parent, its left or its right child
+    node_T *prev = nullptr, *node = root;
+    while (node != nullptr)
+    {
+        auto from_parent = prev == node->parent;
+        if (from_parent)
+        {
+            if (type == 0)
+                std::cout << node->key << ' ';
+            if (node->left != nullptr)
+            {
+                prev = node;
+                node = node->left;
+                continue;
+            }
+        }
+        if (from_parent || prev == node->left)
+        {
+            if (type == 1)
+                std::cout << node->key << ' ';
+            if (node->right != nullptr)
+            {
+                prev = node;
+                node = node->right;
+                continue;
+            }
+        }
+        if (type == 2)
+            std::cout << node->key << ' ';
+        prev = node;
+        node = node->parent;
+    }
     std::cout << std::endl;
 }
 
-template <typename T, typename node_T>
-void BST<T, node_T>::deleteTree(node_T *node)
+// Rotates left children up until the tree is a list along right pointers,
+// so every node is freed without recursion or an explicit stack
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename Free>
+void BST<T, Key, Compare, node_T, alloc_T>::dismantle(node_T *node, Free free)
 {
-    if (node != nullptr)
+    while (node != nullptr)
     {
-        deleteTree(node->left);
-        deleteTree(node->right);
-        delete node;
+        if (node->left != nullptr)
+        {
+            auto temp = node->left;
+            node->left = temp->right;
+            temp->right = node;
+            node = temp;
+        }
+        else
+        {
+            auto temp = node->right;
+            free(node);
+            node = temp;
+        }
     }
 }
 
-template <typename T, typename node_T>
-BST<T, node_T>::~BST() 
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::deleteTree(node_T *node)
+{
+    dismantle(node, [this](node_T *x) { free_node(x); });
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::clear()
 {
-    deleteTree(root);
+    if constexpr (trivially_released<node_T, alloc_T>)
+        alloc.release(); // nothing to destroy so the nodes go with their chunks
+    else
+        deleteTree(root);
     root = nullptr;
+    finger = nullptr;
+    frees++;
+}
+
+// Cuts the largest subtree left at its root until there is one per piece,
+// freeing the roots cut on this thread, then dismantles the subtrees at
+// once. A tree that is mostly one long path may end up with fewer
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::clear(bool parallel)
+{
+    auto pieces = parallel_pieces(size(), parallel);
+    if constexpr (trivially_released<node_T, alloc_T> || !parallel_teardown<alloc_T>)
+        pieces = 1;
+    if (pieces == 1)
+    {
+        clear();
+        return;
+    }
+    std::vector<node_T *> parts{root};
+    auto by_size = [](node_T *a, node_T *b) { return subtree_size(a) < subtree_size(b); };
+    for (int cuts = 0; cuts < 4 * pieces && int(parts.size()) < pieces; cuts++)
+    {
+        auto largest = std::max_element(parts.begin(), parts.end(), by_size);
+        auto node = *largest;
+        *largest = node->left;
+        parts.push_back(node->right);
+        teardown_node(alloc, node);
+    }
+    run_pieces(parts.size(), [&](int j) { dismantle(parts[j], [this](node_T *x) { teardown_node(alloc, x); }); });
+    if constexpr (alloc_T::releases_all)
+        alloc.release();
+    root = nullptr;
+    finger = nullptr;
+    frees++;
+}
+
+// Builds a perfectly balanced tree from items[lo, hi) by taking the middle as the root,
+// the recursion is only log2(n) deep as the halves are balanced
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *BST<T, Key, Compare, node_T, alloc_T>::build(const std::vector<std::pair<Key, T>> &items, int lo, int hi, node_T *parent)
+{
+    if (lo >= hi)
+        return nullptr;
+    auto mid = lo + (hi - lo) / 2;
+    auto node = create_node<node_T>(alloc, items[mid].first, items[mid].second);
+    node->parent = parent;
+    node->left = build(items, lo, mid, node);
+    node->right = build(items, mid + 1, hi, node);
+    node->size = hi - lo;
+    return node;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void BST<T, Key, Compare, node_T, alloc_T>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    clear();
+    root = build(items, 0, items.size(), nullptr);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+BST<T, Key, Compare, node_T, alloc_T>::~BST() 
+{
+    clear();
 }
 
 #endif 
@@ -0,0 +1,389 @@
+#ifndef CONCURRENT_SKIP_LIST_H
+#define CONCURRENT_SKIP_LIST_H
+
+/*
+    Lock free concurrent skip list class
+    Any number of threads may insert, erase and find at the same time.
+    Follows the lock free skip list of Herlihy and Shavit: a node is in
+    the map once it is linked into level 0 with a CAS, the higher levels
+    are then linked one at a time. Erase marks the low bit of each of
+    the node's forward pointers from the top down, the mark on level 0
+    is the moment it leaves the map, and any search that walks past a
+    marked node snips it out. Values are boxed so an insert over an
+    existing key can swap them atomically.
+    lookup and emplace hand out a pointer to the boxed value, it stays
+    readable only while the caller holds an EpochGuard of its own and
+    is a snapshot: an insert over the key swaps in a new box.
+    Unlinked nodes and old values are freed through epoch.hpp. A node
+    is retired by whichever of its inserter and its eraser finishes
+    last, so an inserter still linking upper levels never touches a
+    freed node.
+    clear(), bulk_load() and the destructor must not run alongside
+    other operations.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+#include "map.hpp"
+#include "epoch.hpp"
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class ConcurrentSkipList : public Map<T, Key, Compare>
+{
+private:
+    using order = KeyOrder<Key, Compare>;
+    static constexpr int max_level = 32;
+    struct alignas(std::uintptr_t) Node
+    {
+        Key key;
+        int level;
+        std::atomic<int> owners; // inserter and eraser, the last to let go retires the node
+        std::atomic<T *> value;
+        Node(const Key &k, T *v, int l) : key(k), level(l), owners(2), value(v) {}
+        // forward pointers with the low bit marking the node as erased
+        std::atomic<std::uintptr_t> &next(int i) { return reinterpret_cast<std::atomic<std::uintptr_t> *>(this + 1)[i]; }
+    };
+    Node *head;
+    std::atomic<int> top; // levels any node has ever used, a search starts there
+    std::atomic<long> count;
+
+    static Node *pointer(std::uintptr_t link) { return reinterpret_cast<Node *>(link & ~std::uintptr_t(1)); }
+    static bool marked(std::uintptr_t link) { return link & 1; }
+    static std::uintptr_t link(Node *node) { return reinterpret_cast<std::uintptr_t>(node); }
+    static Node *make_node(const Key &key, T *value, int level);
+    static void free_node(void *node);
+    static int random_level();
+    bool search(const Key &key, Node **preds, Node **succs);
+    template <typename... Args>
+    std::pair<T *, bool> put(const Key &key, bool assign, Args &&...args);
+    void release(Node *node);
+    void free_all();
+
+public:
+    ConcurrentSkipList();
+    ConcurrentSkipList(const ConcurrentSkipList &) = delete;
+    ConcurrentSkipList &operator=(const ConcurrentSkipList &) = delete;
+    void insert(const Key &key, const T &value) override { put(key, true, value); }
+    void insert(const Key &key, T &&value) override { put(key, true, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args) { return put(key, false, std::forward<Args>(args)...); }
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return put(key, true, std::forward<V>(value)).second; }
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    bool find(const Key &key, T &value) override;
+    bool contains(const Key &key);
+    // Visits every key in order. Alongside writers it sees every key that
+    // stays in the map throughout, keys inserted or erased meanwhile may be missed
+    template <typename Visit>
+    void for_each(Visit visit) const;
+    void clear() override;
+    // counts the boxes as the values, meant for a quiescent map
+    MemoryUsage memory_usage() const override;
+    // the level histogram only, the counters are not thread safe so none are kept
+    ShapeStats shape_stats() const override;
+    long size() const { return count.load(std::memory_order_relaxed); }
+    ~ConcurrentSkipList();
+};
+
+template <typename T, typename Key, typename Compare>
+ConcurrentSkipList<T, Key, Compare>::ConcurrentSkipList() : top(1), count(0)
+{
+    head = make_node(Key(), nullptr, max_level);
+}
+
+template <typename T, typename Key, typename Compare>
+typename ConcurrentSkipList<T, Key, Compare>::Node *ConcurrentSkipList<T, Key, Compare>::make_node(const Key &key, T *value, int level)
+{
+    auto p = ::operator new(sizeof(Node) + level * sizeof(std::atomic<std::uintptr_t>));
+    auto node = new (p) Node(key, value, level);
+    for (int i = 0; i < level; i++)
+        new (&node->next(i)) std::atomic<std::uintptr_t>(0);
+    return node;
+}
+
+template <typename T, typename Key, typename Compare>
+void ConcurrentSkipList<T, Key, Compare>::free_node(void *p)
+{
+    auto node = static_cast<Node *>(p);
+    delete node->value.load(std::memory_order_relaxed);
+    node->~Node();
+    ::operator delete(p);
+}
+
+// Geometric with p = 1/2 from the trailing zeros of a per thread xorshift
+template <typename T, typename Key, typename Compare>
+int ConcurrentSkipList<T, Key, Compare>::random_level()
+{
+    thread_local std::uint64_t state = 0x9E3779B97F4A7C15ull ^ reinterpret_cast<std::uintptr_t>(&state);
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return std::min(max_level, 1 + __builtin_ctzll(state | (1ull << (max_level - 1))));
+}
+
+// Fills preds/succs with the nodes either side of key on every level,
+// snipping out marked nodes on the way. Starts over from head if a snip
+// loses a race. Must be called inside an EpochGuard
+template <typename T, typename Key, typename Compare>
+bool ConcurrentSkipList<T, Key, Compare>::search(const Key &key, Node **preds, Node **succs)
+{
+retry:
+    auto levels = top.load(std::memory_order_acquire);
+    for (int l = max_level - 1; l >= levels; l--)
+    {
+        preds[l] = head;
+        succs[l] = nullptr;
+    }
+    auto pred = head;
+    for (int l = levels - 1; l >= 0; l--)
+    {
+        auto curr = pointer(pred->next(l).load(std::memory_order_acquire));
+        while (curr != nullptr)
+        {
+            auto succ = curr->next(l).load(std::memory_order_acquire);
+            while (marked(succ))
+            {
+                auto expected = link(curr);
+                if (!pred->next(l).compare_exchange_strong(expected, link(pointer(succ)), std::memory_order_acq_rel))
+                    goto retry;
+                curr = pointer(succ);
+                if (curr == nullptr)
+                    break;
+                succ = curr->next(l).load(std::memory_order_acquire);
+            }
+            if (curr == nullptr || !order::less(curr->key, key))
+                break;
+            pred = curr;
+            curr = pointer(succ);
+        }
+        preds[l] = pred;
+        succs[l] = curr;
+    }
+    return succs[0] != nullptr && order::equal(succs[0]->key, key);
+}
+
+template <typename T, typename Key, typename Compare>
+void ConcurrentSkipList<T, Key, Compare>::release(Node *node)
+{
+    if (node->owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        retire(node, free_node);
+}
+
+// Inserts a value built from args when key is not there. When it is, the
+// new value replaces the old one if assign is set and is never built if not
+template <typename T, typename Key, typename Compare>
+template <typename... Args>
+std::pair<T *, bool> ConcurrentSkipList<T, Key, Compare>::put(const Key &key, bool assign, Args &&...args)
+{
+    EpochGuard guard;
+    Node *preds[max_level], *succs[max_level];
+    T *box = nullptr;
+    Node *node = nullptr;
+    while (true)
+    {
+        if (search(key, preds, succs))
+        {
+            if (node != nullptr) // never published, nobody else has seen it
+            {
+                node->value.store(nullptr, std::memory_order_relaxed);
+                free_node(node);
+            }
+            if (!assign)
+            {
+                delete box;
+                return {succs[0]->value.load(std::memory_order_acquire), false};
+            }
+            if (box == nullptr)
+                box = new T(std::forward<Args>(args)...);
+            retire(succs[0]->value.exchange(box, std::memory_order_acq_rel));
+            return {box, false};
+        }
+        if (box == nullptr)
+            box = new T(std::forward<Args>(args)...);
+        if (node == nullptr)
+            node = make_node(key, box, random_level());
+        for (int l = 0; l < node->level; l++)
+            node->next(l).store(link(succs[l]), std::memory_order_relaxed);
+        auto levels = top.load(std::memory_order_relaxed);
+        while (levels < node->level && !top.compare_exchange_weak(levels, node->level))
+            ;
+        auto expected = link(succs[0]);
+        if (preds[0]->next(0).compare_exchange_strong(expected, link(node), std::memory_order_release))
+            break;
+    }
+    count.fetch_add(1, std::memory_order_relaxed);
+
+    for (int l = 1; l < node->level; l++)
+    {
+        while (true)
+        {
+            auto next = node->next(l).load(std::memory_order_acquire);
+            if (marked(next)) // being erased, stop building the tower
+                goto linked;
+            if (pointer(next) != succs[l] && !node->next(l).compare_exchange_strong(next, link(succs[l])))
+                continue;
+            auto expected = link(succs[l]);
+            if (preds[l]->next(l).compare_exchange_strong(expected, link(node), std::memory_order_release))
+                break;
+            search(key, preds, succs);
+            if (succs[0] != node) // erased and already snipped from level 0
+                goto linked;
+        }
+    }
+linked:
+    // an eraser may have searched before the last levels went in, snip them now
+    if (marked(node->next(0).load(std::memory_order_acquire)))
+        search(key, preds, succs);
+    release(node);
+    return {box, true};
+}
+
+template <typename T, typename Key, typename Compare>
+void ConcurrentSkipList<T, Key, Compare>::erase(const Key &key)
+{
+    EpochGuard guard;
+    Node *preds[max_level], *succs[max_level];
+    if (!search(key, preds, succs))
+        return;
+    auto node = succs[0];
+    for (int l = node->level - 1; l >= 1; l--)
+    {
+        auto next = node->next(l).load(std::memory_order_acquire);
+        while (!marked(next) && !node->next(l).compare_exchange_weak(next, next | 1))
+            ;
+    }
+    auto next = node->next(0).load(std::memory_order_acquire);
+    while (true)
+    {
+        if (marked(next)) // another eraser got there first
+            return;
+        if (node->next(0).compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+            break;
+    }
+    count.fetch_sub(1, std::memory_order_relaxed);
+    search(key, preds, succs); // unlinks the node from every level
+    release(node);
+}
+
+// Walks past marked nodes without helping, so readers never write
+template <typename T, typename Key, typename Compare>
+T *ConcurrentSkipList<T, Key, Compare>::lookup(const Key &key)
+{
+    EpochGuard guard;
+    auto pred = head;
+    Node *curr = nullptr;
+    for (int l = top.load(std::memory_order_acquire) - 1; l >= 0; l--)
+    {
+        curr = pointer(pred->next(l).load(std::memory_order_acquire));
+        while (curr != nullptr && order::less(curr->key, key))
+        {
+            pred = curr;
+            curr = pointer(curr->next(l).load(std::memory_order_acquire));
+        }
+    }
+    if (curr == nullptr || !order::equal(curr->key, key) || marked(curr->next(0).load(std::memory_order_acquire)))
+        return nullptr;
+    return curr->value.load(std::memory_order_acquire);
+}
+
+template <typename T, typename Key, typename Compare>
+bool ConcurrentSkipList<T, Key, Compare>::find(const Key &key, T &value)
+{
+    EpochGuard guard;
+    auto slot = lookup(key);
+    if (slot == nullptr)
+        return false;
+    value = *slot;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+bool ConcurrentSkipList<T, Key, Compare>::contains(const Key &key)
+{
+    return lookup(key) != nullptr;
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename Visit>
+void ConcurrentSkipList<T, Key, Compare>::for_each(Visit visit) const
+{
+    EpochGuard guard;
+    auto node = pointer(head->next(0).load(std::memory_order_acquire));
+    while (node != nullptr)
+    {
+        auto next = node->next(0).load(std::memory_order_acquire);
+        if (!marked(next))
+            visit(node->key, *node->value.load(std::memory_order_acquire));
+        node = pointer(next);
+    }
+}
+
+template <typename T, typename Key, typename Compare>
+MemoryUsage ConcurrentSkipList<T, Key, Compare>::memory_usage() const
+{
+    MemoryUsage usage;
+    EpochGuard guard;
+    for (auto node = pointer(head->next(0).load(std::memory_order_acquire)); node != nullptr;
+         node = pointer(node->next(0).load(std::memory_order_acquire)))
+    {
+        usage.add_entry(node->key, *node->value.load(std::memory_order_acquire));
+        usage.nodes++;
+        usage.node_bytes += sizeof(Node) + node->level * sizeof(std::atomic<std::uintptr_t>);
+    }
+    usage.aux_bytes = sizeof(*this) + sizeof(Node) + max_level * sizeof(std::atomic<std::uintptr_t>);
+    return usage;
+}
+
+template <typename T, typename Key, typename Compare>
+ShapeStats ConcurrentSkipList<T, Key, Compare>::shape_stats() const
+{
+    ShapeStats stats;
+    EpochGuard guard;
+    for (auto node = pointer(head->next(0).load(std::memory_order_acquire)); node != nullptr;
+         node = pointer(node->next(0).load(std::memory_order_acquire)))
+    {
+        if (marked(node->next(0).load(std::memory_order_acquire)))
+            continue;
+        if (int(stats.levels.size()) < node->level)
+            stats.levels.resize(node->level);
+        stats.levels[node->level - 1]++;
+    }
+    stats.height = stats.levels.size();
+    return stats;
+}
+
+template <typename T, typename Key, typename Compare>
+void ConcurrentSkipList<T, Key, Compare>::free_all()
+{
+    auto x = pointer(head->next(0).load(std::memory_order_relaxed));
+    while (x != nullptr)
+    {
+        auto next = pointer(x->next(0).load(std::memory_order_relaxed));
+        free_node(x);
+        x = next;
+    }
+}
+
+template <typename T, typename Key, typename Compare>
+void ConcurrentSkipList<T, Key, Compare>::clear()
+{
+    free_all();
+    for (int l = 0; l < max_level; l++)
+        head->next(l).store(0, std::memory_order_relaxed);
+    top.store(1);
+    count.store(0);
+}
+
+template <typename T, typename Key, typename Compare>
+ConcurrentSkipList<T, Key, Compare>::~ConcurrentSkipList()
+{
+    free_all();
+    free_node(head);
+}
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+    Epoch based memory reclamation for the lock free structures
+    A thread wraps every access to shared nodes in an EpochGuard, which
+    announces the global epoch it started in. Unlinked nodes are handed
+    to retire() rather than freed, and are only freed once the global
+    epoch has moved two steps past the one they were retired in, by
+    which point every thread that could still hold a pointer to them has
+    left its guard. The epoch only advances when every thread inside a
+    guard has caught up with it.
+*/
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+class EpochDomain
+{
+public:
+    static constexpr std::uint64_t quiescent = UINT64_MAX;
+    static constexpr int max_threads = 256;
+
+    struct Retired
+    {
+        void *object;
+        void (*deleter)(void *);
+        std::uint64_t epoch;
+    };
+
+    // Per thread state, registered on first use and released when the thread exits
+    class Participant
+    {
+    private:
+        EpochDomain &domain;
+        int slot;
+        int depth = 0; // guards nest, only the outermost one announces an epoch
+        std::vector<Retired> retired;
+        friend class EpochDomain;
+
+    public:
+        explicit Participant(EpochDomain &d) : domain(d), slot(d.claim_slot()) {}
+        ~Participant();
+    };
+
+    static EpochDomain &instance()
+    {
+        static EpochDomain domain;
+        return domain;
+    }
+    static Participant &participant()
+    {
+        thread_local Participant p(instance());
+        return p;
+    }
+
+    void enter(Participant &p);
+    void leave(Participant &p);
+    void retire(Participant &p, void *object, void (*deleter)(void *));
+    ~EpochDomain();
+
+private:
+    static constexpr int collect_every = 64; // retires between attempts to advance and free
+    struct alignas(64) Slot
+    {
+        std::atomic<std::uint64_t> epoch{quiescent};
+        std::atomic<bool> used{false};
+    };
+    std::atomic<std::uint64_t> global{0};
+    Slot slots[max_threads];
+    std::mutex orphans_lock;
+    std::vector<Retired> orphans; // left behind by threads that exited
+
+    EpochDomain() = default;
+    int claim_slot();
+    bool try_advance();
+    static void free_until(std::vector<Retired> &list, std::uint64_t safe);
+};
+
+// Keeps the calling thread inside the current epoch for its lifetime
+class EpochGuard
+{
+private:
+    EpochDomain::Participant &p;
+
+public:
+    EpochGuard() : p(EpochDomain::participant()) { EpochDomain::instance().enter(p); }
+    EpochGuard(const EpochGuard &) = delete;
+    EpochGuard &operator=(const EpochGuard &) = delete;
+    ~EpochGuard() { EpochDomain::instance().leave(p); }
+};
+
+// Frees object with delete once no thread can still be reading it
+template <typename U>
+void retire(U *object)
+{
+    EpochDomain::instance().retire(EpochDomain::participant(), object, [](void *o) { delete static_cast<U *>(o); });
+}
+
+inline void retire(void *object, void (*deleter)(void *))
+{
+    EpochDomain::instance().retire(EpochDomain::participant(), object, deleter);
+}
+
+inline int EpochDomain::claim_slot()
+{
+    for (int i = 0; i < max_threads; i++)
+    {
+        bool expected = false;
+        if (!slots[i].used.load(std::memory_order_relaxed) && slots[i].used.compare_exchange_strong(expected, true))
+            return i;
+    }
+    throw std::runtime_error("EpochDomain: too many threads");
+}
+
+inline void EpochDomain::enter(Participant &p)
+{
+    if (p.depth++ > 0)
+        return;
+    // a stale epoch only holds reclamation back. A store, even seq_cst, can
+    // still be passed by the node loads that follow it, so the fence keeps
+    // them behind the announcement: try_advance either sees this slot or
+    // the reader sees the node already unlinked
+    slots[p.slot].epoch.store(global.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+inline void EpochDomain::leave(Participant &p)
+{
+    if (--p.depth > 0)
+        return;
+    slots[p.slot].epoch.store(quiescent, std::memory_order_release);
+}
+
+inline void EpochDomain::retire(Participant &p, void *object, void (*deleter)(void *))
+{
+    p.retired.push_back({object, deleter, global.load(std::memory_order_relaxed)});
+    if (p.retired.size() % collect_every != 0)
+        return;
+    try_advance();
+    auto safe = global.load(std::memory_order_acquire);
+    free_until(p.retired, safe);
+    std::unique_lock<std::mutex> lock(orphans_lock, std::try_to_lock);
+    if (lock.owns_lock())
+        free_until(orphans, safe);
+}
+
+inline bool EpochDomain::try_advance()
+{
+    auto e = global.load(std::memory_order_seq_cst);
+    for (auto &slot : slots)
+    {
+        auto announced = slot.epoch.load(std::memory_order_seq_cst);
+        if (announced != quiescent && announced != e)
+            return false;
+    }
+    return global.compare_exchange_strong(e, e + 1);
+}
+
+// Frees everything retired at least two epochs before safe
+inline void EpochDomain::free_until(std::vector<Retired> &list, std::uint64_t safe)
+{
+    std::size_t kept = 0;
+    for (auto &r : list)
+    {
+        if (r.epoch + 2 <= safe)
+            r.deleter(r.object);
+        else
+            list[kept++] = r;
+    }
+    list.resize(kept);
+}
+
+inline EpochDomain::Participant::~Participant()
+{
+    {
+        std::lock_guard<std::mutex> lock(domain.orphans_lock);
+        domain.orphans.insert(domain.orphans.end(), retired.begin(), retired.end());
+    }
+    domain.slots[slot].epoch.store(quiescent, std::memory_order_release);
+    domain.slots[slot].used.store(false, std::memory_order_release);
+}
+
+// Runs at exit once no other thread is left, so everything can go
+inline EpochDomain::~EpochDomain()
+{
+    free_until(orphans, UINT64_MAX);
+}
+
+#endif
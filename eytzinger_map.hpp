@@ -0,0 +1,295 @@
+#ifndef EYTZINGER_MAP_H
+#define EYTZINGER_MAP_H
+
+/*
+    Eytzinger map class
+    A frozen, read only map for data that is built once and then queried
+    far more often than it changes. The sorted keys are laid out in
+    breadth first (Eytzinger) order of a complete binary search tree, the
+    root at 1 and the children of k at 2k and 2k + 1, in one cache line
+    aligned array. A search walks down with no pointers to follow and no
+    data dependent branch: each step is k = 2k + (key[k] < key), and the
+    lower bound falls out of the bits of where it ends. The cache line
+    holding the keys four levels further down (for int keys) is
+    prefetched at every step, so the misses of successive levels overlap
+    instead of queueing behind each other.
+    Values are kept in the same order, rank and select use the sizes of
+    the implicit subtrees so they need no extra storage.
+    Build one from sorted items or from any map with a for_each.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "key_traits.hpp"
+
+// Hands out cache line aligned arrays, for std::vector
+template <typename X>
+struct CacheAlignedAllocator
+{
+    using value_type = X;
+    static constexpr std::size_t alignment = 64;
+    CacheAlignedAllocator() = default;
+    template <typename Y>
+    CacheAlignedAllocator(const CacheAlignedAllocator<Y> &) {}
+    X *allocate(std::size_t n) { return static_cast<X *>(::operator new(n * sizeof(X), std::align_val_t(alignment))); }
+    void deallocate(X *p, std::size_t) { ::operator delete(p, std::align_val_t(alignment)); }
+    template <typename Y>
+    bool operator==(const CacheAlignedAllocator<Y> &) const { return true; }
+    template <typename Y>
+    bool operator!=(const CacheAlignedAllocator<Y> &) const { return false; }
+};
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class EytzingerMap
+{
+private:
+    using order = KeyOrder<Key, Compare>;
+    using Index = std::uint64_t;
+    // keys[k] for k in [1, n], keys[0] is unused so a cache line of keys
+    // lines up with a block of siblings
+    std::vector<Key, CacheAlignedAllocator<Key>> keys;
+    std::vector<T> values; // values[k - 1] goes with keys[k]
+    Index n;
+    // keys per cache line, the descendants of k that many levels down share one line
+    static constexpr Index stride = sizeof(Key) >= 64 ? 1 : 64 / sizeof(Key);
+
+    template <bool inclusive>
+    Index bound(const Key &key) const;
+    Index first() const;
+    Index next(Index k) const;
+    Index subtree_size(Index k) const;
+    static void prefetch(const void *p);
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using key_compare = Compare;
+    EytzingerMap() : keys(1), n(0) {}
+    // items must be sorted by key without duplicates
+    explicit EytzingerMap(const std::vector<std::pair<Key, T>> &items);
+    // copies every key of map, which needs a for_each(visit(key, value))
+    template <typename M>
+    static EytzingerMap from(const M &map);
+    int size() const { return n; }
+    // the stored value or nullptr, valid as long as the map
+    const T *lookup(const Key &key) const;
+    bool find(const Key &key, T &value) const;
+    bool lower_bound(const Key &key, Key &found, T &value) const;
+    bool upper_bound(const Key &key, Key &found, T &value) const;
+    int rank(const Key &key) const;
+    bool select(int k, Key &found, T &value) const;
+    int count_range(const Key &lo, const Key &hi) const { return std::max(0, rank(hi) - rank(lo)); }
+    template <typename Visit>
+    void range(const Key &lo, const Key &hi, Visit &&visit) const;
+    template <typename Visit>
+    void for_each(Visit &&visit) const;
+};
+
+template <typename T, typename Key, typename Compare>
+void EytzingerMap<T, Key, Compare>::prefetch(const void *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+// The first slot in key order, the leftmost node
+template <typename T, typename Key, typename Compare>
+typename EytzingerMap<T, Key, Compare>::Index EytzingerMap<T, Key, Compare>::first() const
+{
+    if (n == 0)
+        return 0;
+    Index k = 1;
+    while (2 * k <= n)
+        k *= 2;
+    return k;
+}
+
+// The slot after k in key order, 0 after the last
+template <typename T, typename Key, typename Compare>
+typename EytzingerMap<T, Key, Compare>::Index EytzingerMap<T, Key, Compare>::next(Index k) const
+{
+    if (2 * k + 1 <= n)
+    {
+        k = 2 * k + 1;
+        while (2 * k <= n)
+            k *= 2;
+        return k;
+    }
+    while (k & 1) // climb out of right subtrees
+        k >>= 1;
+    return k >> 1;
+}
+
+// Level d below k covers slots [k 2^d, k 2^d + 2^d), as far as n
+template <typename T, typename Key, typename Compare>
+typename EytzingerMap<T, Key, Compare>::Index EytzingerMap<T, Key, Compare>::subtree_size(Index k) const
+{
+    Index size = 0;
+    for (Index width = 1; k <= n; k *= 2, width *= 2)
+        size += std::min(n, k + width - 1) - k + 1;
+    return size;
+}
+
+template <typename T, typename Key, typename Compare>
+EytzingerMap<T, Key, Compare>::EytzingerMap(const std::vector<std::pair<Key, T>> &items) : keys(items.size() + 1), values(items.size()), n(items.size())
+{
+    for (std::size_t i = 1; i < items.size(); i++)
+        if (!order::less(items[i - 1].first, items[i].first))
+            throw std::runtime_error("EytzingerMap: items must be sorted by key without duplicates");
+    // an in order walk of the slots visits them in key order
+    auto k = first();
+    for (const auto &[key, value] : items)
+    {
+        keys[k] = key;
+        values[k - 1] = value;
+        k = next(k);
+    }
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename M>
+EytzingerMap<T, Key, Compare> EytzingerMap<T, Key, Compare>::from(const M &map)
+{
+    std::vector<std::pair<Key, T>> items;
+    map.for_each([&](const Key &key, const T &value) { items.emplace_back(key, value); });
+    auto by_key = [](const std::pair<Key, T> &a, const std::pair<Key, T> &b) { return order::less(a.first, b.first); };
+    if (!std::is_sorted(items.begin(), items.end(), by_key))
+        std::sort(items.begin(), items.end(), by_key);
+    return EytzingerMap(items);
+}
+
+// The slot of the first key >= key when inclusive, > key otherwise, 0 when
+// there is none. Every step goes left (0) or right (1) and appends that bit
+// to k, the bound is the last node the walk went left at, found by dropping
+// the trailing right turns and that left turn
+template <typename T, typename Key, typename Compare>
+template <bool inclusive>
+typename EytzingerMap<T, Key, Compare>::Index EytzingerMap<T, Key, Compare>::bound(const Key &key) const
+{
+    auto base = keys.data();
+    Index k = 1;
+    while (k <= n)
+    {
+        prefetch(base + k * stride);
+        if constexpr (inclusive)
+            k = 2 * k + order::less(base[k], key);
+        else
+            k = 2 * k + !order::less(key, base[k]);
+    }
+#if defined(__GNUC__) || defined(__clang__)
+    return k >> (__builtin_ctzll(~k) + 1);
+#else
+    while (k & 1)
+        k >>= 1;
+    return k >> 1;
+#endif
+}
+
+template <typename T, typename Key, typename Compare>
+const T *EytzingerMap<T, Key, Compare>::lookup(const Key &key) const
+{
+    auto k = bound<true>(key);
+    if (k != 0 && order::equal(keys[k], key))
+        return &values[k - 1];
+    return nullptr;
+}
+
+template <typename T, typename Key, typename Compare>
+bool EytzingerMap<T, Key, Compare>::find(const Key &key, T &value) const
+{
+    auto slot = lookup(key);
+    if (slot == nullptr)
+        return false;
+    value = *slot;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+bool EytzingerMap<T, Key, Compare>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto k = bound<true>(key);
+    if (k == 0)
+        return false;
+    found = keys[k];
+    value = values[k - 1];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+bool EytzingerMap<T, Key, Compare>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto k = bound<false>(key);
+    if (k == 0)
+        return false;
+    found = keys[k];
+    value = values[k - 1];
+    return true;
+}
+
+// Counts the left subtrees and nodes passed on the way down, as BST::rank does
+template <typename T, typename Key, typename Compare>
+int EytzingerMap<T, Key, Compare>::rank(const Key &key) const
+{
+    Index count = 0, k = 1;
+    while (k <= n)
+    {
+        if (order::less(keys[k], key))
+        {
+            count += subtree_size(2 * k) + 1;
+            k = 2 * k + 1;
+        }
+        else
+            k = 2 * k;
+    }
+    return count;
+}
+
+template <typename T, typename Key, typename Compare>
+bool EytzingerMap<T, Key, Compare>::select(int r, Key &found, T &value) const
+{
+    if (r < 0 || Index(r) >= n)
+        return false;
+    Index k = 1, rest = r;
+    while (true)
+    {
+        auto left = subtree_size(2 * k);
+        if (rest == left)
+            break;
+        if (rest < left)
+            k = 2 * k;
+        else
+        {
+            rest -= left + 1;
+            k = 2 * k + 1;
+        }
+    }
+    found = keys[k];
+    value = values[k - 1];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename Visit>
+void EytzingerMap<T, Key, Compare>::range(const Key &lo, const Key &hi, Visit &&visit) const
+{
+    for (auto k = bound<true>(lo); k != 0 && order::less(keys[k], hi); k = next(k))
+        visit(keys[k], values[k - 1]);
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename Visit>
+void EytzingerMap<T, Key, Compare>::for_each(Visit &&visit) const
+{
+    for (auto k = first(); k != 0; k = next(k))
+        visit(keys[k], values[k - 1]);
+}
+
+#endif
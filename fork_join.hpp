@@ -0,0 +1,103 @@
+#ifndef FORK_JOIN_H
+#define FORK_JOIN_H
+
+/*
+    Fork join helpers
+    The parallel bulk loads, walks and teardowns split their keys into
+    pieces, one per hardware thread, and run every piece but the last on
+    a thread of its own while the calling thread takes the last one. Work
+    too small to pay for starting a thread stays on the calling thread.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <thread>
+#include <vector>
+
+// Pieces to split n items into, one per hardware thread with at least
+// grain items each, and 1 when the work is not to be split at all
+inline int parallel_pieces(std::size_t n, bool parallel, std::size_t grain = 1 << 14)
+{
+    if (!parallel)
+        return 1;
+    auto threads = std::max(1u, std::thread::hardware_concurrency());
+    return int(std::max<std::size_t>(1, std::min<std::size_t>(threads, n / grain)));
+}
+
+// The first item of piece j of pieces over n items, j = pieces gives n
+inline std::size_t piece_begin(std::size_t n, int pieces, int j)
+{
+    return n / pieces * j + std::min<std::size_t>(j, n % pieces);
+}
+
+// Runs task(j) for every piece j, all at once, and returns once they are
+// done. An exception from a task is rethrown after every task has finished
+template <typename Task>
+void run_pieces(int pieces, Task task)
+{
+    std::vector<std::future<void>> running;
+    running.reserve(pieces);
+    for (int j = 0; j + 1 < pieces; j++)
+        running.push_back(std::async(std::launch::async, task, j));
+    std::exception_ptr error;
+    try
+    {
+        task(pieces - 1);
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    for (auto &piece : running)
+    {
+        try
+        {
+            piece.get();
+        }
+        catch (...)
+        {
+            if (!error)
+                error = std::current_exception();
+        }
+    }
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// Walks n items in key order split into pieces, piece j on its own thread.
+// at(i) is the item at position i and next(x) the one after x, visit(j, x)
+// is called on every item of piece j in order
+template <typename At, typename Next, typename Visit>
+void walk_pieces(std::size_t n, int pieces, At at, Next next, Visit visit)
+{
+    run_pieces(pieces, [&](int j) {
+        auto begin = piece_begin(n, pieces, j), end = piece_begin(n, pieces, j + 1);
+        if (begin == end)
+            return;
+        auto x = at(begin);
+        for (auto i = begin; i < end; i++, x = next(x))
+            visit(j, x);
+    });
+}
+
+// Folds get(x) over the n items walked as walk_pieces does, in key order
+// with combine, which must be associative. Each piece folds its own items
+// and the pieces are then folded on the calling thread
+template <typename R, typename At, typename Next, typename Get, typename Combine>
+R reduce_pieces(std::size_t n, int pieces, const R &identity, At at, Next next, Get get, Combine combine)
+{
+    struct alignas(64) Part // pieces do not share cache lines
+    {
+        R value;
+    };
+    std::vector<Part> parts(pieces, Part{identity});
+    walk_pieces(n, pieces, at, next, [&](int j, auto x) { parts[j].value = combine(parts[j].value, get(x)); });
+    auto result = identity;
+    for (auto &part : parts)
+        result = combine(result, part.value);
+    return result;
+}
+
+#endif
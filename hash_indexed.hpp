@@ -0,0 +1,302 @@
+#ifndef HASH_INDEXED_H
+#define HASH_INDEXED_H
+
+/*
+    Hash indexed map class
+    Puts an open addressing hash index in front of an ordered map for
+    workloads where point lookups far outnumber ordered queries. The
+    index maps every key straight to its value inside the ordered
+    structure's node, so lookup, find, overwrites and erases of absent
+    keys are one hash probe instead of a descent, while ranges, bounds,
+    rank, select and iteration are still answered by the ordered map.
+    RobinHoodIndex is linear probing where an entry that has come further
+    from its home slot takes the place of one that has come less far, so
+    probe lengths stay short and even at high load, and a lookup can stop
+    at the first entry closer to home than it is. Erases shift the
+    following entries back instead of leaving tombstones.
+    The index holds pointers into the ordered map's nodes, so Impl must
+    keep its values where they are across inserts and erases of other
+    keys, see stable_values in map.hpp. A skip list's automatic
+    rebalancing moves nodes and is turned off.
+    Keys that are equal under Compare must hash the same with std::hash.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "ordered_map.hpp"
+
+template <typename Key, typename V, typename Compare = std::less<Key>>
+class RobinHoodIndex
+{
+private:
+    using order = KeyOrder<Key, Compare>;
+    struct Slot
+    {
+        Key key;
+        V value;
+        std::uint32_t dist; // 0 when empty, otherwise 1 + how far the entry is from its home slot
+    };
+    std::vector<Slot> slots;
+    std::size_t mask;
+    std::size_t count;
+    int shift; // 64 - log2(slots), the top bits of the spread hash give the home slot
+
+    std::size_t home(const Key &key) const { return (std::uint64_t(std::hash<Key>()(key)) * 0x9E3779B97F4A7C15ull) >> shift; }
+    std::size_t slot_of(const Key &key) const;
+    void place(Slot entry);
+    void grow(std::size_t capacity);
+
+public:
+    RobinHoodIndex() { grow(16); }
+    std::size_t size() const { return count; }
+    // the value stored for key or nullptr
+    V *find(const Key &key);
+    const V *find(const Key &key) const { return const_cast<RobinHoodIndex *>(this)->find(key); }
+    // key must not be in the index yet
+    void put(const Key &key, const V &value);
+    // false when key was not there
+    bool remove(const Key &key);
+    void clear();
+    // makes room for n entries without growing again
+    void reserve(std::size_t n);
+    std::size_t bytes() const { return slots.capacity() * sizeof(Slot); }
+};
+
+// Grows once entries fill seven eighths of the slots
+template <typename Key, typename V, typename Compare>
+void RobinHoodIndex<Key, V, Compare>::reserve(std::size_t n)
+{
+    auto capacity = slots.size();
+    while (n * 8 > capacity * 7)
+        capacity *= 2;
+    if (capacity != slots.size())
+        grow(capacity);
+}
+
+template <typename Key, typename V, typename Compare>
+void RobinHoodIndex<Key, V, Compare>::grow(std::size_t capacity)
+{
+    std::vector<Slot> old(capacity);
+    old.swap(slots);
+    mask = capacity - 1;
+    shift = 64;
+    for (auto c = capacity; c > 1; c >>= 1)
+        shift--;
+    count = 0;
+    for (auto &entry : old)
+    {
+        if (entry.dist == 0)
+            continue;
+        entry.dist = 1;
+        place(std::move(entry));
+    }
+}
+
+// Walks from the home slot, swapping entry for any that is closer to its
+// own home than entry is to key's, until entry lands in an empty slot
+template <typename Key, typename V, typename Compare>
+void RobinHoodIndex<Key, V, Compare>::place(Slot entry)
+{
+    auto i = home(entry.key);
+    while (slots[i].dist != 0)
+    {
+        if (slots[i].dist < entry.dist)
+            std::swap(entry, slots[i]);
+        i = (i + 1) & mask;
+        entry.dist++;
+    }
+    slots[i] = std::move(entry);
+    count++;
+}
+
+// The slot holding key or slots.size() when it is absent. Every entry past
+// the point where key would have taken over is closer to its home, so the
+// search stops at the first one that is
+template <typename Key, typename V, typename Compare>
+std::size_t RobinHoodIndex<Key, V, Compare>::slot_of(const Key &key) const
+{
+    auto i = home(key);
+    for (std::uint32_t dist = 1; slots[i].dist >= dist; dist++)
+    {
+        if (slots[i].dist == dist && order::equal(slots[i].key, key))
+            return i;
+        i = (i + 1) & mask;
+    }
+    return slots.size();
+}
+
+template <typename Key, typename V, typename Compare>
+V *RobinHoodIndex<Key, V, Compare>::find(const Key &key)
+{
+    auto i = slot_of(key);
+    return i == slots.size() ? nullptr : &slots[i].value;
+}
+
+template <typename Key, typename V, typename Compare>
+void RobinHoodIndex<Key, V, Compare>::put(const Key &key, const V &value)
+{
+    reserve(count + 1);
+    place(Slot{key, value, 1});
+}
+
+// Shifts the run after the slot back by one so no tombstone is left behind
+template <typename Key, typename V, typename Compare>
+bool RobinHoodIndex<Key, V, Compare>::remove(const Key &key)
+{
+    auto i = slot_of(key);
+    if (i == slots.size())
+        return false;
+    for (auto j = (i + 1) & mask; slots[j].dist > 1; j = (j + 1) & mask)
+    {
+        slots[i] = std::move(slots[j]);
+        slots[i].dist--;
+        i = j;
+    }
+    slots[i] = Slot();
+    count--;
+    return true;
+}
+
+template <typename Key, typename V, typename Compare>
+void RobinHoodIndex<Key, V, Compare>::clear()
+{
+    slots.assign(16, Slot());
+    mask = 15;
+    shift = 60;
+    count = 0;
+}
+
+template <typename Impl>
+class HashIndexed : public OrderedMap<typename Impl::mapped_type, typename Impl::key_type, typename Impl::key_compare>
+{
+public:
+    using key_type = typename Impl::key_type;
+    using mapped_type = typename Impl::mapped_type;
+    using key_compare = typename Impl::key_compare;
+
+private:
+    using Key = key_type;
+    using T = mapped_type;
+    using Base = OrderedMap<T, Key, key_compare>;
+    static_assert(std::is_base_of_v<Base, Impl>, "HashIndexed needs an ordered map");
+    static_assert(stable_values<Impl>::value, "HashIndexed needs a map whose values stay where they are, see stable_values");
+    Impl map;
+    RobinHoodIndex<Key, T *, key_compare> index;
+    void reindex(std::size_t n);
+
+public:
+    using Visitor = typename Base::Visitor;
+    // Impl is built as Impl(args...)
+    template <typename... Args>
+    explicit HashIndexed(const Args &...args);
+    HashIndexed(const HashIndexed &) = delete;
+    HashIndexed &operator=(const HashIndexed &) = delete;
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    void clear() override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    int size() const { return index.size(); }
+    // the ordered map, for its iterators and anything else that only reads it
+    const Impl &ordered() const { return map; }
+
+    void range(const Key &lo, const Key &hi, Visitor visit) const override { map.range(lo, hi, visit); }
+    void for_each(Visitor visit) const override { map.for_each(visit); }
+    bool lower_bound(const Key &key, Key &found, T &value) const override { return map.lower_bound(key, found, value); }
+    bool upper_bound(const Key &key, Key &found, T &value) const override { return map.upper_bound(key, found, value); }
+    int rank(const Key &key) const override { return map.rank(key); }
+    bool select(int k, Key &found, T &value) const override { return map.select(k, found, value); }
+    MemoryUsage memory_usage() const override;
+    ShapeStats shape_stats() const override { return map.shape_stats(); }
+    void reset_counters() override { map.reset_counters(); }
+};
+
+template <typename M, typename = void>
+struct has_auto_rebalance : std::false_type
+{
+};
+
+template <typename M>
+struct has_auto_rebalance<M, std::void_t<decltype(std::declval<M &>().auto_rebalance(false))>> : std::true_type
+{
+};
+
+template <typename Impl>
+template <typename... Args>
+HashIndexed<Impl>::HashIndexed(const Args &...args) : map(args...)
+{
+    if constexpr (has_auto_rebalance<Impl>::value)
+        map.auto_rebalance(false);
+}
+
+// A new key goes into the ordered map with its own single search emplace,
+// the index then points at the value in the new node
+template <typename Impl>
+template <typename... Args>
+std::pair<typename HashIndexed<Impl>::T *, bool> HashIndexed<Impl>::emplace(const Key &key, Args &&...args)
+{
+    if (auto slot = index.find(key))
+        return {*slot, false};
+    auto added = map.emplace(key, std::forward<Args>(args)...);
+    index.put(key, added.first);
+    return added;
+}
+
+// An absent key costs a probe, not a descent
+template <typename Impl>
+void HashIndexed<Impl>::erase(const Key &key)
+{
+    if (index.remove(key))
+        map.erase(key);
+}
+
+template <typename Impl>
+typename HashIndexed<Impl>::T *HashIndexed<Impl>::lookup(const Key &key)
+{
+    auto slot = index.find(key);
+    return slot == nullptr ? nullptr : *slot;
+}
+
+template <typename Impl>
+void HashIndexed<Impl>::clear()
+{
+    map.clear();
+    index.clear();
+}
+
+// for_each hands out the values where they are stored, which are the
+// map's own and not const
+template <typename Impl>
+void HashIndexed<Impl>::reindex(std::size_t n)
+{
+    index.clear();
+    index.reserve(n);
+    map.for_each([&](const Key &key, const T &value) { index.put(key, const_cast<T *>(&value)); });
+}
+
+template <typename Impl>
+void HashIndexed<Impl>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    map.bulk_load(items);
+    reindex(items.size());
+}
+
+template <typename Impl>
+MemoryUsage HashIndexed<Impl>::memory_usage() const
+{
+    auto usage = map.memory_usage();
+    usage.aux_bytes += sizeof(*this) - sizeof(Impl) + index.bytes();
+    return usage;
+}
+
+#endif
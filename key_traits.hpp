@@ -0,0 +1,182 @@
+#ifndef KEY_TRAITS_H
+#define KEY_TRAITS_H
+
+/*
+    Key types and comparisons shared by every structure
+    Structures take the key type and a stateless comparator as template
+    parameters (int and std::less<int> by default) and compare keys only
+    through KeyOrder, which picks the cheapest form at compile time:
+    arithmetic keys in their natural order use the built in operators so
+    comparisons compile to setcc/cmov rather than branches, keys with a
+    compare() member get one three way comparison instead of two less
+    thans, and anything else goes through Compare.
+    The searches over contiguous key arrays use the vector kernels in
+    simd_search.hpp for int and 64 bit keys, a branchless count for other
+    arithmetic keys and std::lower_bound for the rest.
+    InlineString is a short string key stored inline with its first eight
+    bytes cached as an integer, so most comparisons are one integer compare.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include "simd_search.hpp"
+
+template <typename Key, typename Compare>
+constexpr bool natural_order = std::is_same_v<Compare, std::less<Key>> || std::is_same_v<Compare, std::less<>>;
+
+template <typename Key, typename Compare>
+constexpr bool branchless_keys = natural_order<Key, Compare> && std::is_arithmetic_v<Key>;
+
+template <typename Key, typename Compare>
+constexpr bool simd_keys = natural_order<Key, Compare> && (std::is_same_v<Key, int> || std::is_same_v<Key, std::int64_t>);
+
+template <typename Key, typename = void>
+struct has_compare : std::false_type
+{
+};
+
+template <typename Key>
+struct has_compare<Key, std::void_t<decltype(std::declval<const Key &>().compare(std::declval<const Key &>()))>> : std::true_type
+{
+};
+
+template <typename Key, typename Compare = std::less<Key>>
+struct KeyOrder
+{
+    static bool less(const Key &a, const Key &b)
+    {
+        if constexpr (branchless_keys<Key, Compare>)
+            return a < b;
+        else
+            return Compare()(a, b);
+    }
+
+    // Negative, zero or positive as a is before, equal to or after b
+    static int compare(const Key &a, const Key &b)
+    {
+        if constexpr (branchless_keys<Key, Compare>)
+            return (a > b) - (a < b);
+        else if constexpr (natural_order<Key, Compare> && has_compare<Key>::value)
+            return a.compare(b);
+        else
+            return less(a, b) ? -1 : less(b, a);
+    }
+
+    static bool equal(const Key &a, const Key &b)
+    {
+        if constexpr (branchless_keys<Key, Compare>)
+            return a == b;
+        else
+            return compare(a, b) == 0;
+    }
+};
+
+// Number of keys[0, n) before key, the lower bound when keys are sorted
+template <typename Key, typename Compare>
+int count_less_keys(const Key *keys, int n, const Key &key)
+{
+    if constexpr (simd_keys<Key, Compare>)
+        return count_less(keys, n, key);
+    else if constexpr (branchless_keys<Key, Compare>)
+        return count_less_scalar(keys, n, key);
+    else
+        return std::lower_bound(keys, keys + n, key, Compare()) - keys;
+}
+
+// Number of keys[0, n) not after key, the upper bound when keys are sorted
+template <typename Key, typename Compare>
+int count_less_equal_keys(const Key *keys, int n, const Key &key)
+{
+    if constexpr (simd_keys<Key, Compare>)
+        return count_less_equal(keys, n, key);
+    else if constexpr (branchless_keys<Key, Compare>)
+    {
+        int count = 0;
+        for (int i = 0; i < n; i++)
+            count += !(key < keys[i]);
+        return count;
+    }
+    else
+        return std::upper_bound(keys, keys + n, key, Compare()) - keys;
+}
+
+// Lower bound over a sorted array of any length
+template <typename Key, typename Compare>
+int lower_bound_keys(const Key *keys, int n, const Key &key)
+{
+    if constexpr (simd_keys<Key, Compare>)
+        return sorted_lower_bound(keys, n, key);
+    else
+        return std::lower_bound(keys, keys + n, key, Compare()) - keys;
+}
+
+template <typename Key, typename Compare>
+int upper_bound_keys(const Key *keys, int n, const Key &key)
+{
+    if constexpr (simd_keys<Key, Compare>)
+        return sorted_upper_bound(keys, n, key);
+    else
+        return std::upper_bound(keys, keys + n, key, Compare()) - keys;
+}
+
+// A string of up to capacity bytes held inside the key itself. The first
+// eight bytes are kept as a big endian integer so integer order is byte
+// order, the rest are zero padded and compared with one fixed size memcmp
+template <int capacity = 23>
+class InlineString
+{
+private:
+    static_assert(capacity >= 8 && capacity <= 255, "capacity must be between 8 and 255 bytes");
+    std::uint64_t prefix;
+    unsigned char length;
+    char rest[capacity - 8];
+
+public:
+    InlineString() : prefix(0), length(0), rest{} {}
+    InlineString(std::string_view s) : prefix(0), length(s.size()), rest{}
+    {
+        if (s.size() > std::size_t(capacity))
+            throw std::length_error("InlineString: key longer than its capacity");
+        for (std::size_t i = 0; i < 8; i++)
+            prefix = prefix << 8 | (i < s.size() ? static_cast<unsigned char>(s[i]) : 0);
+        if (s.size() > 8)
+            std::memcpy(rest, s.data() + 8, s.size() - 8);
+    }
+    InlineString(const char *s) : InlineString(std::string_view(s)) {}
+    InlineString(const std::string &s) : InlineString(std::string_view(s)) {}
+
+    int size() const { return length; }
+    std::string str() const
+    {
+        std::string s(length, '\0');
+        for (int i = 0; i < length; i++)
+            s[i] = i < 8 ? char(prefix >> (56 - 8 * i)) : rest[i - 8];
+        return s;
+    }
+    int compare(const InlineString &rhs) const
+    {
+        if (prefix != rhs.prefix)
+            return prefix < rhs.prefix ? -1 : 1;
+        if (length <= 8 && rhs.length <= 8) // the common short key never reaches the tail
+            return (length > rhs.length) - (length < rhs.length);
+        if (auto c = std::memcmp(rest, rhs.rest, sizeof(rest)))
+            return c;
+        return (length > rhs.length) - (length < rhs.length);
+    }
+    bool operator<(const InlineString &rhs) const { return compare(rhs) < 0; }
+    bool operator>(const InlineString &rhs) const { return compare(rhs) > 0; }
+    bool operator<=(const InlineString &rhs) const { return compare(rhs) <= 0; }
+    bool operator>=(const InlineString &rhs) const { return compare(rhs) >= 0; }
+    bool operator==(const InlineString &rhs) const { return prefix == rhs.prefix && length == rhs.length && compare(rhs) == 0; }
+    bool operator!=(const InlineString &rhs) const { return !(*this == rhs); }
+    friend std::ostream &operator<<(std::ostream &os, const InlineString &s) { return os << s.str(); }
+};
+
+#endif
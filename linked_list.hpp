@@ -6,224 +6,534 @@
     Written by Dylan Janssen 
     Developed as a teaching execise
     Includes an iterator class to demonstrate writing our own iterators 
+    Nodes come from alloc_T, see node_pool.hpp 
+    Doubly linked so iterators can walk backwards, a list has no way to 
+    skip ahead so lower_bound and range are linear in the keys before lo 
+    Inserts and erases start from the node of the last one, the finger, 
+    and walk forwards or backwards from there, so a key d places from the 
+    last one costs d steps and keys inserted in order are appended in O(1) 
+    Readers keep their own Finger for lookup(key, finger) 
 */
 
+#include <algorithm>
+#include <cstdint>
 #include <iostream> 
+#include <iterator> 
 #include <string> 
-#include "map.hpp"
+#include <utility>
+#include "ordered_map.hpp"
+#include "node_pool.hpp"
 
-template <typename T> 
-class LinkedList : public Map<T>
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename alloc_T = PoolAllocator> 
+class LinkedList : public OrderedMap<T, Key, Compare>
 {
 private: 
+    using order = KeyOrder<Key, Compare>; 
     struct Node 
     {
-        int key; 
+        Key key; 
         T value; 
-        Node *next; 
-        Node(int k, const T &v) : key(k), value(v), next(nullptr) {}
+        Node *next, *prev; 
+        template <typename... Args> 
+        Node(const Key &k, Args &&...args) : key(k), value(std::forward<Args>(args)...), next(nullptr), prev(nullptr) {}
     };
-    Node *head; 
+    Node *head, *tail; 
     int sz; 
+    alloc_T alloc; 
+    mutable ShapeCounters counters; 
+    Node *finger; // the node of the last insert or erase, or a neighbour of it 
+    std::uint64_t frees; // nodes freed so far, a reader's Finger is stale once this moves 
+    void link_before(Node *node, Node *next); 
+    void unlink(Node *node); 
+    void free_node(Node *node); 
+    void append(const Key &key, const T &value); 
+    Node* lower_node(const Key &key) const { return lower_node(key, head); }
+    Node* lower_node(const Key &key, Node *start) const; 
 public: 
-    LinkedList() : head(nullptr), sz(0) {} 
+    using Visitor = typename OrderedMap<T, Key, Compare>::Visitor; 
+    LinkedList() : head(nullptr), tail(nullptr), sz(0), finger(nullptr), frees(0) {} 
     LinkedList(const LinkedList &list);
     LinkedList(LinkedList &&list); 
     ~LinkedList(); 
     int size() const { return sz; }
-    bool find(int key, T &value) override; 
-    void insert(int key, const T &value) override; 
-    void erase(int key) override; 
-    LinkedList<T> operator+(const LinkedList<T> &rhs); 
-    LinkedList<T> operator-(const LinkedList<T> &rhs); 
-    template <typename U> 
-    friend std::ostream& operator<<(std::ostream &os, const LinkedList<U> &list); 
+    T* lookup(const Key &key) override; 
+    // Where a reader's last lookup ended. A lookup with it walks from there, 
+    // and from the head once nodes have been freed 
+    class Finger 
+    {
+    private: 
+        Node *node = nullptr; 
+        std::uint64_t frees = 0; 
+        friend class LinkedList; 
+    };
+    T* lookup(const Key &key, Finger &finger); 
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args> 
+    std::pair<T*, bool> emplace(const Key &key, Args &&...args); 
+    template <typename V> 
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override; 
+    void clear() override; 
+    void insert_batch(const std::vector<std::pair<Key, T>> &items) override; 
+    void erase_batch(const std::vector<Key> &keys) override; 
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override; 
+    void range(const Key &lo, const Key &hi, Visitor visit) const override; 
+    void for_each(Visitor visit) const override; 
+    bool lower_bound(const Key &key, Key &found, T &value) const override; 
+    bool upper_bound(const Key &key, Key &found, T &value) const override; 
+    MemoryUsage memory_usage() const override; 
+    ShapeStats shape_stats() const override; 
+    void reset_counters() override { counters.reset(); }
+    LinkedList operator+(const LinkedList &rhs) const; // union 
+    LinkedList operator-(const LinkedList &rhs) const; // difference 
+    LinkedList operator&(const LinkedList &rhs) const; // intersection 
+    template <typename U, typename K, typename C, typename A> 
+    friend std::ostream& operator<<(std::ostream &os, const LinkedList<U, K, C, A> &list); 
     // Iterator Class 
     class Iterator
     {
     private: 
         Node *curr; 
+        const LinkedList *list; // end() is nullptr, decrementing it needs the tail 
     public: 
-        Iterator(Node *ptr) : curr(ptr) {} 
+        using iterator_category = std::bidirectional_iterator_tag; 
+        using value_type = std::pair<Key, T>; 
+        using difference_type = std::ptrdiff_t; 
+        using pointer = void; 
+        using reference = OrderedEntry<T, Key>; 
+        Iterator(Node *ptr, const LinkedList *l) : curr(ptr), list(l) {} 
         // prefix ++ // increments and returns incremented value 
         Iterator& operator++();
         // postfix ++ // increments and returns preincremented value 
         Iterator operator++(int);
-        std::pair<int, T> operator*() const { return std::pair<int, T>(curr->key, curr->value); } // dereference 
-        bool operator==(const Iterator &rhs) { return curr == rhs.curr; }
-        bool operator!=(const Iterator &rhs) { return curr != rhs.curr; }
+        Iterator& operator--();
+        Iterator operator--(int);
+        reference operator*() const { return reference(curr->key, curr->value); } // dereference 
+        bool operator==(const Iterator &rhs) const { return curr == rhs.curr; }
+        bool operator!=(const Iterator &rhs) const { return curr != rhs.curr; }
     };
+    using ReverseIterator = std::reverse_iterator<Iterator>; 
 
     // LinkedList Iterator Methods 
-    Iterator begin() const { return Iterator(head); }
-    Iterator end() const { return Iterator(nullptr); }
+    Iterator begin() const { return Iterator(head, this); }
+    Iterator end() const { return Iterator(nullptr, this); }
+    ReverseIterator rbegin() const { return ReverseIterator(end()); }
+    ReverseIterator rend() const { return ReverseIterator(begin()); }
+    Iterator lower_bound(const Key &key) const { return Iterator(lower_node(key), this); }
+    Iterator upper_bound(const Key &key) const; 
 };
 
 
-template <typename T> 
-LinkedList<T>::LinkedList(const LinkedList &list) : LinkedList()
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T>::LinkedList(const LinkedList &list) : LinkedList()
 {
     for (auto [key, value] : list) 
-        insert(key, value);
+        append(key, value);
 }
 
-template <typename T> 
-LinkedList<T>::LinkedList(LinkedList &&list) : LinkedList() 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T>::LinkedList(LinkedList &&list) : LinkedList() 
 {
-    swap(head, list.head); 
-    swap(sz, list.sz); 
+    std::swap(head, list.head); 
+    std::swap(tail, list.tail); 
+    std::swap(sz, list.sz); 
+    std::swap(alloc, list.alloc); 
+    std::swap(finger, list.finger); 
+    list.frees++; // its readers' fingers point into this list now 
 }
 
-template <typename T> 
-LinkedList<T>::~LinkedList()
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T>::~LinkedList()
 {
-    auto x = head; 
-    while (x != nullptr)
+    clear(); 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::clear()
+{
+    if constexpr (trivially_released<Node, alloc_T>)
+        alloc.release(); // nothing to destroy so the nodes go with their chunks 
+    else 
     {
-        auto next = x->next; 
-        delete x; 
-        x = next; 
+        auto x = head; 
+        while (x != nullptr)
+        {
+            auto next = x->next; 
+            destroy_node(alloc, x); 
+            x = next; 
+        }
     }
+    head = tail = finger = nullptr; 
+    sz = 0; 
+    frees++; 
 }
 
-template <typename T> 
-bool LinkedList<T>::find(int key, T &value)
+// Links node in front of next, or at the tail when next is nullptr 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::link_before(Node *node, Node *next)
 {
-    auto x = head; 
-    while (x != nullptr) 
+    node->next = next; 
+    node->prev = next != nullptr ? next->prev : tail; 
+    if (node->prev != nullptr)
+        node->prev->next = node; 
+    else 
+        head = node; 
+    if (next != nullptr)
+        next->prev = node; 
+    else 
+        tail = node; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::unlink(Node *node)
+{
+    if (node->prev != nullptr)
+        node->prev->next = node->next; 
+    else 
+        head = node->next; 
+    if (node->next != nullptr)
+        node->next->prev = node->prev; 
+    else 
+        tail = node->prev; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::free_node(Node *node)
+{
+    destroy_node(alloc, node); 
+    frees++; 
+}
+
+// Only for keys above every key in the list 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::append(const Key &key, const T &value)
+{
+    link_before(create_node<Node>(alloc, key, value), nullptr); 
+    sz++; 
+}
+
+// The first node with a key >= key, walking forwards from start when its 
+// key is below key and backwards otherwise. A null start is the head 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Node* LinkedList<T, Key, Compare, alloc_T>::lower_node(const Key &key, Node *start) const
+{
+    auto probe = counters.probe(); 
+    auto x = start != nullptr ? start : head; 
+    if (x == nullptr)
+        return nullptr; 
+    probe.step(); 
+    probe.compare(); 
+    if (!order::less(x->key, key))
     {
-        if (x->key == key)
+        for (; x->prev != nullptr && !order::less(x->prev->key, key); x = x->prev)
         {
-            value = x->value; 
-            return true; 
+            probe.step(); 
+            probe.compare(); 
         }
-        if (x->key > key) 
-            return false; 
-        x = x->next; 
+        return x; 
     }
-    return false; 
+    for (x = x->next; x != nullptr; x = x->next)
+    {
+        probe.step(); 
+        probe.compare(); 
+        if (!order::less(x->key, key))
+            break; 
+    }
+    return x; 
 }
 
-template <typename T> 
-void LinkedList<T>::insert(int key, const T &value)
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+T* LinkedList<T, Key, Compare, alloc_T>::lookup(const Key &key)
 {
+    auto probe = counters.probe(); 
     auto x = head; 
-    Node *prev = nullptr; 
     while (x != nullptr) 
     {
-        if (x->key == key)
-        {
-            x->value = value; 
-            return; 
-        }
-        if (x->key > key)
-            break;
-        prev = x; 
+        probe.step(); 
+        probe.compare(); 
+        auto c = order::compare(x->key, key); 
+        if (c == 0)
+            return &x->value; 
+        if (c > 0) 
+            return nullptr; 
         x = x->next; 
     }
-    auto *node = new Node(key, value); 
-    if (prev != nullptr) // insert between prev and x 
+    return nullptr; 
+}
+
+// The finger is left on the node the walk ended at, or the tail past the end 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+T* LinkedList<T, Key, Compare, alloc_T>::lookup(const Key &key, Finger &f)
+{
+    auto x = lower_node(key, f.frees == frees ? f.node : nullptr); 
+    f.node = x != nullptr ? x : tail; 
+    f.frees = frees; 
+    return x != nullptr && order::equal(x->key, key) ? &x->value : nullptr; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+template <typename... Args> 
+std::pair<T*, bool> LinkedList<T, Key, Compare, alloc_T>::emplace(const Key &key, Args &&...args)
+{
+    auto x = lower_node(key, finger); 
+    if (x != nullptr && order::equal(x->key, key))
     {
-        node->next = prev->next; 
-        prev->next = node; 
+        finger = x; 
+        return {&x->value, false}; 
     }
-    else // insert at head 
+    auto node = create_node<Node>(alloc, key, std::forward<Args>(args)...); 
+    link_before(node, x); 
+    finger = node; 
+    sz++; 
+    counters.update(); 
+    return {&node->value, true}; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::erase(const Key &key)
+{
+    auto x = lower_node(key, finger); 
+    if (x != nullptr && order::equal(x->key, key)) // delete x 
     {
-        node->next = head; 
-        head = node; 
+        unlink(x); 
+        finger = x->next != nullptr ? x->next : x->prev; 
+        free_node(x); 
+        sz--;
+        counters.update(); 
     }
-    sz++; 
 }
 
-template <typename T> 
-void LinkedList<T>::erase(int key)
+// Merge the sorted batch in a single pass instead of rescanning from head per key
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::insert_batch(const std::vector<std::pair<Key, T>> &items)
 {
+    auto by_key = [](const std::pair<Key, T> &a, const std::pair<Key, T> &b) { return order::less(a.first, b.first); };
+    std::vector<std::pair<Key, T>> sorted; 
+    const auto *batch = &items; 
+    if (!std::is_sorted(items.begin(), items.end(), by_key))
+    {
+        sorted = items; 
+        std::stable_sort(sorted.begin(), sorted.end(), by_key);
+        batch = &sorted; 
+    }
+    auto x = head; // the node a new node would be linked in front of 
+    for (const auto &[key, value] : *batch)
+    {
+        while (x != nullptr && order::less(x->key, key))
+            x = x->next; 
+        if (x != nullptr && order::equal(x->key, key))
+        {
+            x->value = value; 
+            continue; 
+        }
+        auto node = create_node<Node>(alloc, key, value); 
+        link_before(node, x); 
+        x = node; // a repeated key in the batch must find this node 
+        sz++; 
+    }
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::erase_batch(const std::vector<Key> &keys)
+{
+    std::vector<Key> sorted(keys); 
+    std::sort(sorted.begin(), sorted.end(), order::less); 
     auto x = head; 
-    Node *prev = nullptr; 
-    while (x != nullptr) 
+    for (const auto &key : sorted)
     {
-        if (x->key == key) // delete x 
+        while (x != nullptr && order::less(x->key, key))
+            x = x->next; 
+        if (x != nullptr && order::equal(x->key, key))
         {
-            if (prev != nullptr)
-                prev->next = x->next; 
-            else 
-                head = x->next; 
-            delete x; 
-            sz--;
-            return; 
+            auto next = x->next; 
+            unlink(x); 
+            free_node(x); 
+            x = next; 
+            sz--; 
         }
-        if (x->key > key) 
-            return; 
-        prev = x; 
-        x = x->next; 
     }
+    finger = nullptr; 
+}
+
+// Items are already sorted so every node is appended at the tail 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    clear(); 
+    for (const auto &[key, value] : items)
+        append(key, value); 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::range(const Key &lo, const Key &hi, Visitor visit) const
+{
+    for (auto x = lower_node(lo); x != nullptr && order::less(x->key, hi); x = x->next)
+        visit(x->key, x->value); 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+void LinkedList<T, Key, Compare, alloc_T>::for_each(Visitor visit) const
+{
+    for (auto x = head; x != nullptr; x = x->next)
+        visit(x->key, x->value); 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+MemoryUsage LinkedList<T, Key, Compare, alloc_T>::memory_usage() const
+{
+    MemoryUsage usage; 
+    for (auto x = head; x != nullptr; x = x->next)
+        usage.add_entry(x->key, x->value); 
+    auto node = alloc.block_size(sizeof(Node)); 
+    usage.nodes = sz; 
+    usage.node_bytes += sz * (node - sizeof(T)); 
+    usage.aux_bytes = sizeof(*this) + allocator_slack(alloc, sz * node); 
+    return usage; 
+}
+
+// A list is one path, the key at position p is p nodes deep 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+ShapeStats LinkedList<T, Key, Compare, alloc_T>::shape_stats() const
+{
+    ShapeStats stats; 
+    stats.height = sz; 
+    stats.mean_depth = sz == 0 ? 0 : (sz + 1) / 2.0; 
+    counters.report(stats); 
+    return stats; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+bool LinkedList<T, Key, Compare, alloc_T>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto x = lower_node(key); 
+    if (x == nullptr)
+        return false; 
+    found = x->key; 
+    value = x->value; 
+    return true; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+bool LinkedList<T, Key, Compare, alloc_T>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto it = upper_bound(key); 
+    if (it == end())
+        return false; 
+    found = (*it).first; 
+    value = (*it).second; 
+    return true; 
 }
 
-// Overload the + operator to merge two lists, removing duplicates
-template <typename T> 
-LinkedList<T> LinkedList<T>::operator+(const LinkedList<T> &rhs)
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Iterator LinkedList<T, Key, Compare, alloc_T>::upper_bound(const Key &key) const
 {
-    LinkedList<T> result; 
+    auto x = head; 
+    while (x != nullptr && !order::less(key, x->key))
+        x = x->next; 
+    return Iterator(x, this); 
+}
+
+// Overload the + operator to merge two lists, removing duplicates 
+// Both lists are sorted so one pass appending at the tail is enough, 
+// a key in both keeps the value from this list 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T> LinkedList<T, Key, Compare, alloc_T>::operator+(const LinkedList<T, Key, Compare, alloc_T> &rhs) const
+{
+    LinkedList result; 
     auto lhs_ptr = head; 
     auto rhs_ptr = rhs.head; 
     while (lhs_ptr != nullptr && rhs_ptr != nullptr) 
     {
-        if (lhs_ptr->key < rhs_ptr->key)
+        auto c = order::compare(lhs_ptr->key, rhs_ptr->key); 
+        if (c < 0)
         {
-            result.insert(lhs_ptr->key, lhs_ptr->value);
+            result.append(lhs_ptr->key, lhs_ptr->value);
             lhs_ptr = lhs_ptr->next; 
         }
-        else if (rhs_ptr->key < lhs_ptr->key) 
+        else if (c > 0) 
         {
-            result.insert(rhs_ptr->key, rhs_ptr->value);
+            result.append(rhs_ptr->key, rhs_ptr->value);
             rhs_ptr = rhs_ptr->next; 
         }
         else 
         {
-            result.insert(lhs_ptr->key, lhs_ptr->value);
+            result.append(lhs_ptr->key, lhs_ptr->value);
             lhs_ptr = lhs_ptr->next; 
             rhs_ptr = rhs_ptr->next; 
         }
     }
-    while (lhs_ptr != nullptr)
-    {
-        result.insert(lhs_ptr->key, lhs_ptr->value);
-        lhs_ptr = lhs_ptr->next;
-    }
-    while (rhs_ptr != nullptr)
+    for (; lhs_ptr != nullptr; lhs_ptr = lhs_ptr->next)
+        result.append(lhs_ptr->key, lhs_ptr->value);
+    for (; rhs_ptr != nullptr; rhs_ptr = rhs_ptr->next)
+        result.append(rhs_ptr->key, rhs_ptr->value);
+    return result; 
+}
+
+// The keys of this list that are not in rhs 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T> LinkedList<T, Key, Compare, alloc_T>::operator-(const LinkedList<T, Key, Compare, alloc_T> &rhs) const
+{
+    LinkedList result; 
+    auto rhs_ptr = rhs.head; 
+    for (auto lhs_ptr = head; lhs_ptr != nullptr; lhs_ptr = lhs_ptr->next)
     {
-        result.insert(rhs_ptr->key, rhs_ptr->value);
-        rhs_ptr = rhs_ptr->next; 
+        while (rhs_ptr != nullptr && order::less(rhs_ptr->key, lhs_ptr->key))
+            rhs_ptr = rhs_ptr->next; 
+        if (rhs_ptr == nullptr || !order::equal(rhs_ptr->key, lhs_ptr->key))
+            result.append(lhs_ptr->key, lhs_ptr->value);
     }
     return result; 
 }
 
-template <typename T> 
-LinkedList<T> LinkedList<T>::operator-(const LinkedList<T> &rhs) 
+// The keys in both lists, with the values from this list 
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+LinkedList<T, Key, Compare, alloc_T> LinkedList<T, Key, Compare, alloc_T>::operator&(const LinkedList<T, Key, Compare, alloc_T> &rhs) const
 {
-    LinkedList<std::string> result(*this); 
-    for (auto [key, value] : rhs)
-        result.erase(key); 
+    LinkedList result; 
+    auto rhs_ptr = rhs.head; 
+    for (auto lhs_ptr = head; lhs_ptr != nullptr && rhs_ptr != nullptr; lhs_ptr = lhs_ptr->next)
+    {
+        while (rhs_ptr != nullptr && order::less(rhs_ptr->key, lhs_ptr->key))
+            rhs_ptr = rhs_ptr->next; 
+        if (rhs_ptr != nullptr && order::equal(rhs_ptr->key, lhs_ptr->key))
+            result.append(lhs_ptr->key, lhs_ptr->value);
+    }
     return result; 
 }
 
-template <typename T> 
-typename LinkedList<T>::Iterator& LinkedList<T>::Iterator::operator++()
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Iterator& LinkedList<T, Key, Compare, alloc_T>::Iterator::operator++()
 {
     curr = curr->next; 
     return *this; 
 }
 
-template <typename T> 
-typename LinkedList<T>::Iterator LinkedList<T>::Iterator::operator++(int)
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Iterator LinkedList<T, Key, Compare, alloc_T>::Iterator::operator++(int)
 {
-    LinkedList<T>::Iterator temp = *this; 
+    LinkedList<T, Key, Compare, alloc_T>::Iterator temp = *this; 
     curr = curr->next; 
     return temp; 
 }
 
-template <typename U> 
-std::ostream& operator<<(std::ostream &os, const LinkedList<U> &list)
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Iterator& LinkedList<T, Key, Compare, alloc_T>::Iterator::operator--()
+{
+    curr = curr != nullptr ? curr->prev : list->tail; 
+    return *this; 
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T> 
+typename LinkedList<T, Key, Compare, alloc_T>::Iterator LinkedList<T, Key, Compare, alloc_T>::Iterator::operator--(int)
+{
+    LinkedList<T, Key, Compare, alloc_T>::Iterator temp = *this; 
+    --*this; 
+    return temp; 
+}
+
+template <typename U, typename K, typename C, typename A> 
+std::ostream& operator<<(std::ostream &os, const LinkedList<U, K, C, A> &list)
 {
     auto x = list.head; 
     while (x != nullptr) 
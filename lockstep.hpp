@@ -0,0 +1,54 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+/*
+    Lockstep searches
+    A search down a tree or skip list is a chain of loads, each waiting on
+    the cache miss of the one before, so one search at a time leaves the
+    memory system idle for most of its latency. A batch of searches can
+    instead be advanced together: each takes one step, prefetches the
+    node its next step will read and hands over to the next search, so by
+    the time a search comes round again its node is on its way or there.
+    in_lockstep keeps a group of G searches going this way, starting the
+    next key of the batch in the place of each one that finishes.
+*/
+
+#include <cstddef>
+
+// Asks for the cache line at p without waiting for it, null is fine
+inline void prefetch_node(const void *p)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+// Runs searches 0 to n - 1 G at a time. start(state, i) sets up search i
+// and step(state) advances one by a node, true once it is done. A search
+// that finishes is replaced by the next one, the last few run down as a
+// smaller group
+template <int G, typename State, typename Start, typename Step>
+void in_lockstep(std::size_t n, Start start, Step step)
+{
+    State group[G];
+    int active = 0;
+    std::size_t next = 0;
+    for (; active < G && next < n; active++)
+        start(group[active], next++);
+    while (active > 0)
+    {
+        for (int g = 0; g < active;)
+        {
+            if (!step(group[g]))
+                g++;
+            else if (next < n)
+                start(group[g++], next++);
+            else
+                group[g] = group[--active];
+        }
+    }
+}
+
+#endif
@@ -1,19 +1,378 @@
 #ifndef MAP_H
-#define MAP_H 
+#define MAP_H
 
 /*
     Abstract base class for key-value DS
-    Written by Dylan Janssen 
+    Written by Dylan Janssen
+    Batch operations have default implementations built on the
+    single key operations, structures override them when they can
+    do better than one call per key
+    Keys are ordered by Compare, see key_traits.hpp
+    Values are moved or constructed in place where the caller allows it,
+    and lookup hands out a pointer to the stored value so reads need not
+    copy it
+    DirectMap is the static counterpart of the virtual interface, generic
+    code written against it is compiled per concrete type and inlined
+    memory_usage reports what a map costs, see MemoryUsage, and shape_stats
+    how it is laid out and searched, see shape_stats.hpp
 */
 
-template <typename T> 
-class Map 
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "key_traits.hpp"
+#include "shape_stats.hpp"
+
+// Heap memory x owns beyond sizeof(x), counted for strings too long for their inline buffer
+template <typename X>
+std::size_t owned_bytes(const X &)
+{
+    return 0;
+}
+
+inline std::size_t owned_bytes(const std::string &s)
+{
+    auto self = reinterpret_cast<const char *>(&s);
+    if (s.data() >= self && s.data() < self + sizeof(s))
+        return 0;
+    return s.capacity() + 1;
+}
+
+// The memory a map holds, in bytes. Allocations are counted at the size the
+// allocator hands out, and a pool's unused chunk space is the map's too
+struct MemoryUsage
+{
+    long keys = 0;
+    long nodes = 0;              // allocations or array slots holding keys
+    std::size_t node_bytes = 0;  // those, less the values in them, plus what the keys own
+    std::size_t value_bytes = 0; // the values where they are stored plus what they own
+    std::size_t aux_bytes = 0;   // the rest: the map object, sentinels, inner nodes, spare capacity, allocator slack
+    std::size_t total() const { return node_bytes + value_bytes + aux_bytes; }
+    double bytes_per_key() const { return keys == 0 ? 0 : double(total()) / keys; }
+    // counts a stored key and value, the bytes they own and the value itself
+    template <typename Key, typename T>
+    void add_entry(const Key &key, const T &value)
+    {
+        keys++;
+        node_bytes += owned_bytes(key);
+        value_bytes += sizeof(T) + owned_bytes(value);
+    }
+};
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class Map
 {
 public:
-    virtual void insert(int key, const T &value) = 0; 
-    virtual void erase(int key) = 0;
-    virtual bool find(int key, T &value) = 0;
+    using key_type = Key;
+    using mapped_type = T;
+    using key_compare = Compare;
+    // inserts or overwrites
+    virtual void insert(const Key &key, const T &value) = 0;
+    virtual void insert(const Key &key, T &&value) = 0;
+    virtual void erase(const Key &key) = 0;
+    // the stored value or nullptr, valid until the next insert, erase or clear
+    virtual T *lookup(const Key &key) = 0;
+    // copies the stored value out
+    virtual bool find(const Key &key, T &value);
+    virtual void clear() = 0;
+    // Constructs the value from args when key is not there, otherwise leaves
+    // it alone. Returns the stored value and whether it was inserted.
+    // Structures hide this with a version that searches once
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    // inserts or overwrites, returns true when key was not there
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value);
+    // later items win when a key appears more than once
+    virtual void insert_batch(const std::vector<std::pair<Key, T>> &items);
+    virtual void erase_batch(const std::vector<Key> &keys);
+    // fills values and found in the same order as keys, returns the number found
+    virtual int find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found);
+    // replaces the contents, items must be sorted by key without duplicates
+    virtual void bulk_load(const std::vector<std::pair<Key, T>> &items);
+    // Walks every key to count what it owns, so O(n). Empty for a map
+    // that cannot tell
+    virtual MemoryUsage memory_usage() const { return MemoryUsage(); }
+    // Walks the structure for its layout and adds the counters when they
+    // are kept. Empty for a map that cannot tell
+    virtual ShapeStats shape_stats() const { return ShapeStats(); }
+    virtual void reset_counters() {}
     virtual ~Map(){};
 };
 
-#endif 
\ No newline at end of file
+// insert_or_assign for any map with an emplace that leaves existing values alone
+template <typename M, typename V>
+bool emplace_or_assign(M &map, const typename M::key_type &key, V &&value)
+{
+    auto [slot, inserted] = map.emplace(key, std::forward<V>(value));
+    if (!inserted) // emplace did not touch value
+        *slot = std::forward<V>(value);
+    return inserted;
+}
+
+template <typename T, typename Key, typename Compare>
+bool Map<T, Key, Compare>::find(const Key &key, T &value)
+{
+    auto slot = lookup(key);
+    if (slot == nullptr)
+        return false;
+    value = *slot;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename... Args>
+std::pair<T *, bool> Map<T, Key, Compare>::emplace(const Key &key, Args &&...args)
+{
+    if (auto slot = lookup(key))
+        return {slot, false};
+    insert(key, T(std::forward<Args>(args)...));
+    return {lookup(key), true};
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename V>
+bool Map<T, Key, Compare>::insert_or_assign(const Key &key, V &&value)
+{
+    return emplace_or_assign(*this, key, std::forward<V>(value));
+}
+
+/*
+    The default batch algorithms, written against any map M so the same
+    code serves the virtual interface (M = Map) and DirectMap
+*/
+
+template <typename M, typename Items>
+void default_insert_batch(M &&map, const Items &items)
+{
+    using Order = KeyOrder<typename std::decay_t<M>::key_type, typename std::decay_t<M>::key_compare>;
+    auto by_key = [](const auto &a, const auto &b) { return Order::less(a.first, b.first); };
+    if (std::is_sorted(items.begin(), items.end(), by_key))
+    {
+        for (const auto &[key, value] : items)
+            map.insert(key, value);
+        return;
+    }
+    // visiting keys in order keeps consecutive searches on the same path
+    Items sorted(items);
+    std::stable_sort(sorted.begin(), sorted.end(), by_key);
+    for (const auto &[key, value] : sorted)
+        map.insert(key, value);
+}
+
+template <typename M, typename Keys>
+void default_erase_batch(M &&map, const Keys &keys)
+{
+    for (const auto &key : keys)
+        map.erase(key);
+}
+
+template <typename M, typename Keys, typename Values>
+int default_find_batch(M &&map, const Keys &keys, Values &values, std::vector<bool> &found)
+{
+    values.resize(keys.size());
+    found.assign(keys.size(), false);
+    int count = 0;
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        if (map.find(keys[i], values[i]))
+        {
+            found[i] = true;
+            count++;
+        }
+    }
+    return count;
+}
+
+// find_batch for a map with a find_many(keys, slots) that looks up every key at once
+template <typename M, typename Keys, typename Values>
+int find_batch_by_many(M &&map, const Keys &keys, Values &values, std::vector<bool> &found)
+{
+    std::vector<typename std::decay_t<M>::mapped_type *> slots;
+    auto count = map.find_many(keys, slots);
+    values.resize(keys.size());
+    found.assign(keys.size(), false);
+    for (std::size_t i = 0; i < keys.size(); i++)
+    {
+        if (slots[i] != nullptr)
+        {
+            values[i] = *slots[i];
+            found[i] = true;
+        }
+    }
+    return count;
+}
+
+template <typename M, typename Items>
+void default_bulk_load(M &&map, const Items &items)
+{
+    map.clear();
+    for (const auto &[key, value] : items)
+        map.insert(key, value);
+}
+
+template <typename T, typename Key, typename Compare>
+void Map<T, Key, Compare>::insert_batch(const std::vector<std::pair<Key, T>> &items)
+{
+    default_insert_batch(*this, items);
+}
+
+template <typename T, typename Key, typename Compare>
+void Map<T, Key, Compare>::erase_batch(const std::vector<Key> &keys)
+{
+    default_erase_batch(*this, keys);
+}
+
+template <typename T, typename Key, typename Compare>
+int Map<T, Key, Compare>::find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found)
+{
+    return default_find_batch(*this, keys, values, found);
+}
+
+template <typename T, typename Key, typename Compare>
+void Map<T, Key, Compare>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    default_bulk_load(*this, items);
+}
+
+/*
+    Static interface
+    Any type with key_type, mapped_type, key_compare and the insert, erase,
+    lookup, find and clear members of Map is a map, whether or not it derives from
+    Map. Every structure here is one.
+*/
+
+template <typename M, typename = void>
+struct is_map : std::false_type
+{
+};
+
+template <typename M>
+struct is_map<M, std::void_t<typename M::key_compare,
+                             decltype(std::declval<M &>().insert(std::declval<const typename M::key_type &>(), std::declval<const typename M::mapped_type &>())),
+                             decltype(std::declval<M &>().erase(std::declval<const typename M::key_type &>())),
+                             decltype(static_cast<typename M::mapped_type *>(std::declval<M &>().lookup(std::declval<const typename M::key_type &>()))),
+                             decltype(bool(std::declval<M &>().find(std::declval<const typename M::key_type &>(), std::declval<typename M::mapped_type &>()))),
+                             decltype(std::declval<M &>().clear())>> : std::true_type
+{
+};
+
+template <typename M>
+constexpr bool is_map_v = is_map<M>::value;
+
+// True when the pointer lookup hands out stays valid until its own key is
+// erased, whatever else is inserted and erased. Node based maps keep values
+// in their nodes, maps that keep them in arrays specialise this to false
+template <typename M>
+struct stable_values : std::true_type
+{
+};
+
+template <typename C>
+struct is_map_class : std::false_type
+{
+};
+
+template <typename T, typename Key, typename Compare>
+struct is_map_class<Map<T, Key, Compare>> : std::true_type
+{
+};
+
+// True for &M::member when M inherits the member from Map rather than declaring its own.
+// Where M overloads the member, declared_by_map<Signature>(&M::member) picks the one
+template <typename F, typename C>
+constexpr bool declared_by_map(F C::*)
+{
+    return is_map_class<C>::value;
+}
+
+// Calls the members of a concrete map by their qualified names, which binds
+// them at compile time so they can be inlined into the caller's loop even
+// though they are virtual. The object must really be an M, not a subclass
+// of it that overrides them. Batch operations M inherits from Map run the
+// default algorithm on the DirectMap instead, so each key is a direct call
+template <typename M>
+class DirectMap
+{
+private:
+    static_assert(is_map_v<M>, "DirectMap needs a type with the Map members");
+    static_assert(!std::is_abstract_v<M>, "DirectMap needs the concrete type, the object's own members are called");
+    M &map;
+
+public:
+    using key_type = typename M::key_type;
+    using mapped_type = typename M::mapped_type;
+    using key_compare = typename M::key_compare;
+    explicit DirectMap(M &m) : map(m) {}
+    M &get() const { return map; }
+
+    void insert(const key_type &key, const mapped_type &value) { map.M::insert(key, value); }
+    void insert(const key_type &key, mapped_type &&value) { map.M::insert(key, std::move(value)); }
+    void erase(const key_type &key) { map.M::erase(key); }
+    mapped_type *lookup(const key_type &key) { return map.M::lookup(key); }
+    bool find(const key_type &key, mapped_type &value)
+    {
+        if constexpr (declared_by_map(&M::find))
+        {
+            auto slot = lookup(key);
+            if (slot == nullptr)
+                return false;
+            value = *slot;
+            return true;
+        }
+        else
+            return map.M::find(key, value);
+    }
+    void clear() { map.M::clear(); }
+    template <typename... Args>
+    std::pair<mapped_type *, bool> emplace(const key_type &key, Args &&...args) { return map.emplace(key, std::forward<Args>(args)...); }
+    template <typename V>
+    bool insert_or_assign(const key_type &key, V &&value) { return map.insert_or_assign(key, std::forward<V>(value)); }
+
+    void insert_batch(const std::vector<std::pair<key_type, mapped_type>> &items)
+    {
+        if constexpr (declared_by_map(&M::insert_batch))
+            default_insert_batch(*this, items);
+        else
+            map.M::insert_batch(items);
+    }
+    void erase_batch(const std::vector<key_type> &keys)
+    {
+        if constexpr (declared_by_map(&M::erase_batch))
+            default_erase_batch(*this, keys);
+        else
+            map.M::erase_batch(keys);
+    }
+    int find_batch(const std::vector<key_type> &keys, std::vector<mapped_type> &values, std::vector<bool> &found)
+    {
+        if constexpr (declared_by_map(&M::find_batch))
+            return default_find_batch(*this, keys, values, found);
+        else
+            return map.M::find_batch(keys, values, found);
+    }
+    void bulk_load(const std::vector<std::pair<key_type, mapped_type>> &items)
+    {
+        if constexpr (declared_by_map<void(const std::vector<std::pair<key_type, mapped_type>> &)>(&M::bulk_load))
+            default_bulk_load(*this, items);
+        else
+            map.M::bulk_load(items);
+    }
+
+    // Only instantiated for maps that have them
+    template <typename Visit>
+    void range(const key_type &lo, const key_type &hi, Visit &&visit) const { map.M::range(lo, hi, visit); }
+    template <typename Visit>
+    void for_each(Visit &&visit) const { map.M::for_each(visit); }
+};
+
+template <typename M>
+DirectMap<M> direct(M &map)
+{
+    return DirectMap<M>(map);
+}
+
+#endif
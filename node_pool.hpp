@@ -0,0 +1,244 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+/*
+    Node allocators shared by the linked structures
+    Structures take the allocator as a template parameter and call
+    create_node/destroy_node instead of new/delete. PoolAllocator carves
+    same size nodes out of contiguous chunks, keeps a free list per size
+    so erased nodes are reused, and gives every chunk back at once when
+    it is destroyed. HeapAllocator is plain new/delete per node.
+    Chunks are cache line aligned, so a node type aligned to a cache line
+    (whose size is then a multiple of it) gets cache line aligned blocks.
+    block_size and reserved let a structure account for its memory: the
+    bytes a request really takes and the bytes held from the system in
+    chunks, 0 for an allocator that has none.
+    An allocator is used by one thread at a time unless it is concurrent.
+    Parallel bulk loads give each thread an allocator of its own and then
+    adopt() them all into the structure's.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+class HeapAllocator
+{
+public:
+    static constexpr bool releases_all = false;
+    static constexpr bool concurrent = true; // new and delete may be called from any thread
+    void adopt(HeapAllocator &&) {}
+    std::size_t block_size(std::size_t bytes) const { return bytes; }
+    std::size_t reserved() const { return 0; }
+    void *allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t))
+    {
+        if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            return ::operator new(bytes, std::align_val_t(align));
+        return ::operator new(bytes);
+    }
+    void deallocate(void *p, std::size_t, std::size_t align = alignof(std::max_align_t))
+    {
+        if (align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+            ::operator delete(p, std::align_val_t(align));
+        else
+            ::operator delete(p);
+    }
+};
+
+class PoolAllocator
+{
+private:
+    static constexpr std::size_t granularity = alignof(std::max_align_t);
+    static constexpr std::size_t chunk_align = 64;
+    static constexpr std::size_t chunk_bytes = 64 * 1024;
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+    // every distinct rounded node size has its own free list and chunk to carve from
+    struct SizeClass
+    {
+        FreeBlock *free = nullptr;
+        char *next = nullptr, *end = nullptr;
+    };
+    std::vector<SizeClass> classes;
+    std::vector<void *> chunks;
+    std::size_t chunk_total = 0;
+
+    void *refill(SizeClass &c, std::size_t block);
+
+public:
+    static constexpr bool releases_all = true;
+    static constexpr bool concurrent = false;
+    PoolAllocator() = default;
+    PoolAllocator(const PoolAllocator &) = delete;
+    PoolAllocator(PoolAllocator &&other) noexcept : classes(std::move(other.classes)), chunks(std::move(other.chunks)), chunk_total(other.chunk_total)
+    {
+        other.classes.clear();
+        other.chunks.clear();
+        other.chunk_total = 0;
+    }
+    PoolAllocator &operator=(PoolAllocator &&other) noexcept;
+    ~PoolAllocator() { release(); }
+    std::size_t block_size(std::size_t bytes) const { return (bytes + granularity - 1) / granularity * granularity; }
+    std::size_t reserved() const { return chunk_total; }
+    void *allocate(std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+    void deallocate(void *p, std::size_t bytes, std::size_t align = alignof(std::max_align_t));
+    void release(); // frees every chunk, nodes still in them are gone without their destructors running
+    // Takes over other's chunks with the nodes in them, which this pool then
+    // frees, and other's free blocks, which it hands out again
+    void adopt(PoolAllocator &&other);
+};
+
+inline PoolAllocator &PoolAllocator::operator=(PoolAllocator &&other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        std::swap(classes, other.classes);
+        std::swap(chunks, other.chunks);
+        std::swap(chunk_total, other.chunk_total);
+    }
+    return *this;
+}
+
+inline void *PoolAllocator::refill(SizeClass &c, std::size_t block)
+{
+    auto bytes = std::max(chunk_bytes, block * 16);
+    auto *chunk = static_cast<char *>(::operator new(bytes, std::align_val_t(chunk_align)));
+    chunks.push_back(chunk);
+    chunk_total += bytes;
+    c.next = chunk + block;
+    c.end = chunk + bytes / block * block;
+    return chunk;
+}
+
+// align may be at most chunk_align and must divide bytes, which sizeof guarantees
+inline void *PoolAllocator::allocate(std::size_t bytes, std::size_t)
+{
+    auto index = (bytes + granularity - 1) / granularity;
+    if (index >= classes.size())
+        classes.resize(index + 1);
+    auto &c = classes[index];
+    if (c.free != nullptr)
+    {
+        auto *block = c.free;
+        c.free = block->next;
+        return block;
+    }
+    auto block = index * granularity;
+    if (c.next == c.end)
+        return refill(c, block);
+    auto *p = c.next;
+    c.next += block;
+    return p;
+}
+
+inline void PoolAllocator::deallocate(void *p, std::size_t bytes, std::size_t)
+{
+    auto &c = classes[(bytes + granularity - 1) / granularity];
+    auto *block = static_cast<FreeBlock *>(p);
+    block->next = c.free;
+    c.free = block;
+}
+
+inline void PoolAllocator::adopt(PoolAllocator &&other)
+{
+    if (classes.size() < other.classes.size())
+        classes.resize(other.classes.size());
+    for (std::size_t index = 0; index < other.classes.size(); index++)
+    {
+        auto &c = classes[index], &o = other.classes[index];
+        if (c.next == c.end)
+        {
+            c.next = o.next;
+            c.end = o.end;
+        }
+        else // the rest of other's chunk goes on the free list block by block
+        {
+            for (auto *p = o.next; p != o.end; p += index * granularity)
+            {
+                auto *block = reinterpret_cast<FreeBlock *>(p);
+                block->next = o.free;
+                o.free = block;
+            }
+        }
+        if (o.free == nullptr)
+            continue;
+        auto *tail = o.free;
+        while (tail->next != nullptr)
+            tail = tail->next;
+        tail->next = c.free;
+        c.free = o.free;
+    }
+    chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+    chunk_total += other.chunk_total;
+    other.chunks.clear();
+    other.classes.clear();
+    other.chunk_total = 0;
+}
+
+inline void PoolAllocator::release()
+{
+    for (auto *chunk : chunks)
+        ::operator delete(chunk, std::align_val_t(chunk_align));
+    chunks.clear();
+    classes.clear();
+    chunk_total = 0;
+}
+
+// True when dropping the allocator disposes of node_T, so a structure can skip walking its nodes on destruction
+template <typename node_T, typename alloc_T>
+constexpr bool trivially_released = alloc_T::releases_all && std::is_trivially_destructible<node_T>::value;
+
+// What alloc holds beyond the used bytes structures have accounted for: free blocks and uncarved chunk space
+template <typename alloc_T>
+std::size_t allocator_slack(const alloc_T &alloc, std::size_t used)
+{
+    return alloc.reserved() > used ? alloc.reserved() - used : 0;
+}
+
+template <typename node_T, typename alloc_T, typename... Args>
+node_T *create_node(alloc_T &alloc, Args &&...args)
+{
+    static_assert(alignof(node_T) <= 64, "nodes may be aligned to at most a cache line");
+    auto *p = alloc.allocate(sizeof(node_T), alignof(node_T));
+    try
+    {
+        return new (p) node_T(std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        alloc.deallocate(p, sizeof(node_T), alignof(node_T));
+        throw;
+    }
+}
+
+template <typename node_T, typename alloc_T>
+void destroy_node(alloc_T &alloc, node_T *node)
+{
+    node->~node_T();
+    alloc.deallocate(node, sizeof(node_T), alignof(node_T));
+}
+
+// True when a structure's nodes can be torn down by several threads at
+// once: either alloc is concurrent or it gives every chunk back afterwards,
+// so the threads only need to run the destructors
+template <typename alloc_T>
+constexpr bool parallel_teardown = alloc_T::concurrent || alloc_T::releases_all;
+
+// destroy_node for one of the threads of a parallel teardown, the caller
+// releases alloc afterwards when it releases all
+template <typename node_T, typename alloc_T>
+void teardown_node(alloc_T &alloc, node_T *node)
+{
+    if constexpr (alloc_T::releases_all)
+        node->~node_T();
+    else
+        destroy_node(alloc, node);
+}
+
+#endif
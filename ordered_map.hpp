@@ -0,0 +1,92 @@
+#ifndef ORDERED_MAP_H
+#define ORDERED_MAP_H
+
+/*
+    Abstract base class for maps that keep their keys in order
+    Adds ordered queries on top of Map: the first key at or after a
+    key, and visiting every key of a range in ascending order. Visitors
+    are passed as a FunctionRef, a non owning reference to any callable,
+    so a scan through the virtual interface never allocates.
+    Each structure also has its own bidirectional Iterator with begin,
+    end, rbegin, rend, lower_bound and upper_bound for use when the
+    concrete type is known.
+    Order statistics count keys by position: rank, select and count_range
+    walk every key by default, the trees and skip list keep subtree sizes
+    or link widths so theirs are O(log n).
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include "map.hpp"
+
+template <typename Signature>
+class FunctionRef;
+
+// Borrows a callable for the length of a call, it must outlive the FunctionRef
+template <typename R, typename... Args>
+class FunctionRef<R(Args...)>
+{
+private:
+    void *object;
+    R (*call)(void *, Args...);
+
+public:
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, FunctionRef>>>
+    FunctionRef(F &&f)
+        : object(const_cast<void *>(static_cast<const void *>(std::addressof(f)))),
+          call([](void *o, Args... args) -> R { return (*static_cast<std::remove_reference_t<F> *>(o))(std::forward<Args>(args)...); })
+    {
+    }
+    R operator()(Args... args) const { return call(object, std::forward<Args>(args)...); }
+};
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class OrderedMap : public Map<T, Key, Compare>
+{
+public:
+    using Visitor = FunctionRef<void(const Key &, const T &)>;
+    // calls visit(key, value) for every key in [lo, hi) in ascending order
+    virtual void range(const Key &lo, const Key &hi, Visitor visit) const = 0;
+    // calls visit(key, value) for every key in ascending order
+    virtual void for_each(Visitor visit) const = 0;
+    // the smallest key >= key (lower_bound) or > key (upper_bound), false when there is none
+    virtual bool lower_bound(const Key &key, Key &found, T &value) const = 0;
+    virtual bool upper_bound(const Key &key, Key &found, T &value) const = 0;
+    // the number of keys < key
+    virtual int rank(const Key &key) const;
+    // the key with k keys before it, so select(0) is the smallest, false when there are k or fewer keys
+    virtual bool select(int k, Key &found, T &value) const;
+    // the number of keys in [lo, hi)
+    int count_range(const Key &lo, const Key &hi) const { return std::max(0, rank(hi) - rank(lo)); }
+};
+
+template <typename T, typename Key, typename Compare>
+int OrderedMap<T, Key, Compare>::rank(const Key &key) const
+{
+    int count = 0;
+    for_each([&](const Key &k, const T &) { count += KeyOrder<Key, Compare>::less(k, key); });
+    return count;
+}
+
+template <typename T, typename Key, typename Compare>
+bool OrderedMap<T, Key, Compare>::select(int k, Key &found, T &value) const
+{
+    int pos = 0;
+    for_each([&](const Key &key, const T &v) {
+        if (pos++ == k)
+        {
+            found = key;
+            value = v;
+        }
+    });
+    return k >= 0 && k < pos;
+}
+
+// Shared by the Iterator classes, references to a key and its value
+template <typename T, typename Key = int>
+using OrderedEntry = std::pair<const Key &, const T &>;
+
+#endif
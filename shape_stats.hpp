@@ -0,0 +1,109 @@
+#ifndef SHAPE_STATS_H
+#define SHAPE_STATS_H
+
+/*
+    Shape statistics
+    ShapeStats says how a structure is laid out and how its searches walk it.
+    The layout (height, mean depth of a key, the skip list level histogram)
+    is measured by walking the structure when shape_stats() is called.
+    The running counters of search paths, key comparisons and rotations are
+    only kept when compiled with -DDS_ENABLE_COUNTERS. Without it
+    ShapeCounters is empty and every call on it compiles to nothing, so
+    normal builds pay nothing per operation.
+    Counters are plain integers, a structure shared between threads keeps
+    none.
+*/
+
+#include <algorithm>
+#include <vector>
+
+struct ShapeStats
+{
+    int height = 0;           // nodes on the longest path from the root to a key, levels for a skip list
+    double mean_depth = 0;    // nodes on the path to a key averaged over the keys
+    std::vector<long> levels; // skip lists only, levels[i] towers are i + 1 high
+    bool counted = false;     // the counters below were kept, see DS_ENABLE_COUNTERS
+    long searches = 0;        // descents by key, from finds, inserts and erases alike
+    long path_nodes = 0;      // nodes the searches visited
+    long longest_path = 0;
+    long comparisons = 0;     // key comparisons, a search within a node or array counts as a binary search would
+    long updates = 0;         // inserts of new keys and erases of present ones
+    long rotations = 0;
+    double mean_path() const { return searches == 0 ? 0 : double(path_nodes) / searches; }
+    double comparisons_per_search() const { return searches == 0 ? 0 : double(comparisons) / searches; }
+    double rotations_per_update() const { return updates == 0 ? 0 : double(rotations) / updates; }
+};
+
+// The comparisons a binary search over n keys makes
+inline int binary_search_comparisons(int n)
+{
+    int c = 0;
+    for (; n > 0; n >>= 1)
+        c++;
+    return c;
+}
+
+#ifdef DS_ENABLE_COUNTERS
+
+class ShapeCounters
+{
+private:
+    long searches = 0, path_nodes = 0, longest_path = 0, comparisons = 0, updates = 0, rotations = 0;
+
+public:
+    // One search, recorded when it goes out of scope
+    class Probe
+    {
+    private:
+        ShapeCounters &counters;
+        long path = 0, compares = 0;
+
+    public:
+        explicit Probe(ShapeCounters &c) : counters(c) {}
+        Probe(const Probe &) = delete;
+        void step(long n = 1) { path += n; }
+        void compare(long n = 1) { compares += n; }
+        ~Probe()
+        {
+            counters.searches++;
+            counters.path_nodes += path;
+            counters.longest_path = std::max(counters.longest_path, path);
+            counters.comparisons += compares;
+        }
+    };
+    Probe probe() { return Probe(*this); }
+    void update() { updates++; }
+    void rotation() { rotations++; }
+    void reset() { *this = ShapeCounters(); }
+    void report(ShapeStats &stats) const
+    {
+        stats.counted = true;
+        stats.searches = searches;
+        stats.path_nodes = path_nodes;
+        stats.longest_path = longest_path;
+        stats.comparisons = comparisons;
+        stats.updates = updates;
+        stats.rotations = rotations;
+    }
+};
+
+#else
+
+class ShapeCounters
+{
+public:
+    struct Probe
+    {
+        void step(long = 1) {}
+        void compare(long = 1) {}
+    };
+    Probe probe() { return Probe(); }
+    void update() {}
+    void rotation() {}
+    void reset() {}
+    void report(ShapeStats &) const {}
+};
+
+#endif
+
+#endif
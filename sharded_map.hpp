@@ -0,0 +1,306 @@
+#ifndef SHARDED_MAP_H
+#define SHARDED_MAP_H
+
+/*
+    Sharded map class
+    Lets any of the single threaded maps be shared between threads by
+    splitting the keys over a number of independent Impl instances, each
+    behind its own reader writer lock. A key's shard comes from its hash
+    spread by a multiplicative hash, so runs of neighbouring keys land on
+    different shards and threads working on nearby keys rarely meet.
+    Every shard sits on its own cache lines, so taking one lock never
+    invalidates the line holding another.
+    Reads take their shard's lock shared, writes take it alone. Batch
+    operations group their keys by shard and lock each shard once for
+    its whole group.
+    Impl's reads must not write to the structure, which holds for every
+    map here; their shape counters (DS_ENABLE_COUNTERS) are not kept
+    thread safe. lookup hands out a pointer that is only safe while no
+    other thread writes to that key's shard, find copies under the lock.
+    for_each visits shard by shard, so keys do not come in order.
+*/
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "map.hpp"
+
+template <typename Impl>
+class ShardedMap : public Map<typename Impl::mapped_type, typename Impl::key_type, typename Impl::key_compare>
+{
+public:
+    using key_type = typename Impl::key_type;
+    using mapped_type = typename Impl::mapped_type;
+    using key_compare = typename Impl::key_compare;
+
+private:
+    using Key = key_type;
+    using T = mapped_type;
+    struct alignas(64) Shard
+    {
+        mutable std::shared_mutex lock;
+        Impl map;
+        template <typename... Args>
+        explicit Shard(const Args &...args) : map(args...) {}
+    };
+    std::vector<std::unique_ptr<Shard>> shards;
+    int count;
+    int shift; // 64 - log2(count), the top bits of the spread hash pick the shard
+
+    Shard &shard_of(const Key &key) const { return *shards[index(key)]; }
+    // indices into keys grouped by shard, in their original order within a shard
+    template <typename Keys, typename Get>
+    std::vector<std::vector<int>> group(const Keys &keys, Get get) const;
+
+public:
+    // four shards per hardware thread
+    static int default_shards();
+    // shards is rounded up to a power of two, each shard is built as Impl(args...)
+    template <typename... Args>
+    explicit ShardedMap(int shards = default_shards(), const Args &...args);
+    ShardedMap(const ShardedMap &) = delete;
+    ShardedMap &operator=(const ShardedMap &) = delete;
+    int shard_count() const { return count; }
+    int index(const Key &key) const;
+    void insert(const Key &key, const T &value) override;
+    void insert(const Key &key, T &&value) override;
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    bool find(const Key &key, T &value) override;
+    void clear() override;
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value);
+    void insert_batch(const std::vector<std::pair<Key, T>> &items) override;
+    void erase_batch(const std::vector<Key> &keys) override;
+    int find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found) override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    MemoryUsage memory_usage() const override;
+    // Only instantiated for an Impl that has it
+    template <typename Visit>
+    void for_each(Visit &&visit) const;
+};
+
+template <typename Impl>
+int ShardedMap<Impl>::default_shards()
+{
+    return 4 * std::max(1u, std::thread::hardware_concurrency());
+}
+
+template <typename Impl>
+template <typename... Args>
+ShardedMap<Impl>::ShardedMap(int n, const Args &...args) : count(1), shift(64)
+{
+    if (n < 1)
+        throw std::invalid_argument("ShardedMap: needs at least one shard");
+    while (count < n)
+    {
+        count *= 2;
+        shift--;
+    }
+    // a Shard holds a mutex so it cannot move, each one is allocated on its own
+    shards.reserve(count);
+    for (int s = 0; s < count; s++)
+        shards.push_back(std::make_unique<Shard>(args...));
+}
+
+template <typename Impl>
+int ShardedMap<Impl>::index(const Key &key) const
+{
+    if (shift == 64)
+        return 0;
+    std::uint64_t h = std::hash<Key>()(key);
+    return (h * 0x9E3779B97F4A7C15ull) >> shift;
+}
+
+template <typename Impl>
+template <typename Keys, typename Get>
+std::vector<std::vector<int>> ShardedMap<Impl>::group(const Keys &keys, Get get) const
+{
+    std::vector<std::vector<int>> groups(count);
+    for (std::size_t i = 0; i < keys.size(); i++)
+        groups[index(get(keys[i]))].push_back(i);
+    return groups;
+}
+
+template <typename Impl>
+void ShardedMap<Impl>::insert(const Key &key, const T &value)
+{
+    auto &shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.map.insert(key, value);
+}
+
+template <typename Impl>
+void ShardedMap<Impl>::insert(const Key &key, T &&value)
+{
+    auto &shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.map.insert(key, std::move(value));
+}
+
+template <typename Impl>
+void ShardedMap<Impl>::erase(const Key &key)
+{
+    auto &shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    shard.map.erase(key);
+}
+
+template <typename Impl>
+typename ShardedMap<Impl>::T *ShardedMap<Impl>::lookup(const Key &key)
+{
+    auto &shard = shard_of(key);
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.map.lookup(key);
+}
+
+template <typename Impl>
+bool ShardedMap<Impl>::find(const Key &key, T &value)
+{
+    auto &shard = shard_of(key);
+    std::shared_lock<std::shared_mutex> guard(shard.lock);
+    return shard.map.find(key, value);
+}
+
+template <typename Impl>
+void ShardedMap<Impl>::clear()
+{
+    for (int s = 0; s < count; s++)
+    {
+        std::unique_lock<std::shared_mutex> guard(shards[s]->lock);
+        shards[s]->map.clear();
+    }
+}
+
+template <typename Impl>
+template <typename... Args>
+std::pair<typename ShardedMap<Impl>::T *, bool> ShardedMap<Impl>::emplace(const Key &key, Args &&...args)
+{
+    auto &shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.map.emplace(key, std::forward<Args>(args)...);
+}
+
+template <typename Impl>
+template <typename V>
+bool ShardedMap<Impl>::insert_or_assign(const Key &key, V &&value)
+{
+    auto &shard = shard_of(key);
+    std::unique_lock<std::shared_mutex> guard(shard.lock);
+    return shard.map.insert_or_assign(key, std::forward<V>(value));
+}
+
+// Each shard gets its items in their original order, so later items still win
+template <typename Impl>
+void ShardedMap<Impl>::insert_batch(const std::vector<std::pair<Key, T>> &items)
+{
+    auto groups = group(items, [](const std::pair<Key, T> &item) -> const Key & { return item.first; });
+    std::vector<std::pair<Key, T>> part;
+    for (int s = 0; s < count; s++)
+    {
+        if (groups[s].empty())
+            continue;
+        part.clear();
+        for (auto i : groups[s])
+            part.push_back(items[i]);
+        std::unique_lock<std::shared_mutex> guard(shards[s]->lock);
+        shards[s]->map.insert_batch(part);
+    }
+}
+
+template <typename Impl>
+void ShardedMap<Impl>::erase_batch(const std::vector<Key> &keys)
+{
+    auto groups = group(keys, [](const Key &key) -> const Key & { return key; });
+    std::vector<Key> part;
+    for (int s = 0; s < count; s++)
+    {
+        if (groups[s].empty())
+            continue;
+        part.clear();
+        for (auto i : groups[s])
+            part.push_back(keys[i]);
+        std::unique_lock<std::shared_mutex> guard(shards[s]->lock);
+        shards[s]->map.erase_batch(part);
+    }
+}
+
+template <typename Impl>
+int ShardedMap<Impl>::find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found)
+{
+    auto groups = group(keys, [](const Key &key) -> const Key & { return key; });
+    values.resize(keys.size());
+    found.assign(keys.size(), false);
+    int hits = 0;
+    for (int s = 0; s < count; s++)
+    {
+        if (groups[s].empty())
+            continue;
+        std::shared_lock<std::shared_mutex> guard(shards[s]->lock);
+        for (auto i : groups[s])
+        {
+            if (shards[s]->map.find(keys[i], values[i]))
+            {
+                found[i] = true;
+                hits++;
+            }
+        }
+    }
+    return hits;
+}
+
+// Splitting sorted items by shard keeps every part sorted
+template <typename Impl>
+void ShardedMap<Impl>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    std::vector<std::vector<std::pair<Key, T>>> parts(count);
+    for (const auto &item : items)
+        parts[index(item.first)].push_back(item);
+    for (int s = 0; s < count; s++)
+    {
+        std::unique_lock<std::shared_mutex> guard(shards[s]->lock);
+        shards[s]->map.bulk_load(parts[s]);
+    }
+}
+
+template <typename Impl>
+MemoryUsage ShardedMap<Impl>::memory_usage() const
+{
+    MemoryUsage usage;
+    usage.aux_bytes = sizeof(*this);
+    for (int s = 0; s < count; s++)
+    {
+        std::shared_lock<std::shared_mutex> guard(shards[s]->lock);
+        auto part = shards[s]->map.memory_usage();
+        usage.keys += part.keys;
+        usage.nodes += part.nodes;
+        usage.node_bytes += part.node_bytes;
+        usage.value_bytes += part.value_bytes;
+        // the map object itself is in part's aux, the lock and padding are not
+        usage.aux_bytes += part.aux_bytes + sizeof(Shard) - sizeof(Impl);
+    }
+    return usage;
+}
+
+template <typename Impl>
+template <typename Visit>
+void ShardedMap<Impl>::for_each(Visit &&visit) const
+{
+    for (int s = 0; s < count; s++)
+    {
+        std::shared_lock<std::shared_mutex> guard(shards[s]->lock);
+        shards[s]->map.for_each(visit);
+    }
+}
+
+#endif
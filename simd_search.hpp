@@ -0,0 +1,166 @@
+#ifndef SIMD_SEARCH_H
+#define SIMD_SEARCH_H
+
+/*
+    Vectorised search over sorted blocks of int keys
+    count_less compares 16 (AVX-512) or 8 (AVX2) keys per instruction and
+    popcounts the resulting mask, the instruction set is picked once at
+    startup from what the CPU supports with a scalar loop as the fallback.
+    Used by every structure that stores its keys contiguously.
+    64 bit keys have the same kernels at half the keys per instruction.
+*/
+
+#include <climits>
+#include <cstdint>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_SEARCH_X86
+#include <immintrin.h>
+#endif
+
+enum class SimdLevel
+{
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+inline SimdLevel detect_simd_level()
+{
+#ifdef SIMD_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+inline const SimdLevel simd_level = detect_simd_level();
+
+// Branchless count of keys[0, n) below key, equal to the lower bound when keys are sorted
+template <typename K>
+inline int count_less_scalar(const K *keys, int n, K key)
+{
+    int count = 0;
+    for (int i = 0; i < n; i++)
+        count += keys[i] < key;
+    return count;
+}
+
+#ifdef SIMD_SEARCH_X86
+__attribute__((target("avx2"))) inline int count_less_avx2(const int *keys, int n, int key)
+{
+    auto k = _mm256_set1_epi32(key);
+    int count = 0, i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        auto less = _mm256_cmpgt_epi32(k, v);
+        count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(less)));
+    }
+    for (; i < n; i++)
+        count += keys[i] < key;
+    return count;
+}
+
+__attribute__((target("avx512f"))) inline int count_less_avx512(const int *keys, int n, int key)
+{
+    auto k = _mm512_set1_epi32(key);
+    int count = 0, i = 0;
+    for (; i + 16 <= n; i += 16)
+        count += __builtin_popcount(_mm512_cmplt_epi32_mask(_mm512_loadu_si512(keys + i), k));
+    if (i < n) // the tail is a masked load so nothing past keys[n) is touched
+    {
+        __mmask16 tail = (1u << (n - i)) - 1;
+        count += __builtin_popcount(_mm512_mask_cmplt_epi32_mask(tail, _mm512_maskz_loadu_epi32(tail, keys + i), k));
+    }
+    return count;
+}
+
+__attribute__((target("avx2"))) inline int count_less_avx2(const std::int64_t *keys, int n, std::int64_t key)
+{
+    auto k = _mm256_set1_epi64x(key);
+    int count = 0, i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(keys + i));
+        auto less = _mm256_cmpgt_epi64(k, v);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(less)));
+    }
+    for (; i < n; i++)
+        count += keys[i] < key;
+    return count;
+}
+
+__attribute__((target("avx512f"))) inline int count_less_avx512(const std::int64_t *keys, int n, std::int64_t key)
+{
+    auto k = _mm512_set1_epi64(key);
+    int count = 0, i = 0;
+    for (; i + 8 <= n; i += 8)
+        count += __builtin_popcount(_mm512_cmplt_epi64_mask(_mm512_loadu_si512(keys + i), k));
+    if (i < n)
+    {
+        __mmask8 tail = (1u << (n - i)) - 1;
+        count += __builtin_popcount(_mm512_mask_cmplt_epi64_mask(tail, _mm512_maskz_loadu_epi64(tail, keys + i), k));
+    }
+    return count;
+}
+#endif
+
+inline int count_less(const int *keys, int n, int key)
+{
+#ifdef SIMD_SEARCH_X86
+    if (simd_level == SimdLevel::AVX512)
+        return count_less_avx512(keys, n, key);
+    if (simd_level == SimdLevel::AVX2)
+        return count_less_avx2(keys, n, key);
+#endif
+    return count_less_scalar(keys, n, key);
+}
+
+inline int count_less(const std::int64_t *keys, int n, std::int64_t key)
+{
+#ifdef SIMD_SEARCH_X86
+    if (simd_level == SimdLevel::AVX512)
+        return count_less_avx512(keys, n, key);
+    if (simd_level == SimdLevel::AVX2)
+        return count_less_avx2(keys, n, key);
+#endif
+    return count_less_scalar(keys, n, key);
+}
+
+template <typename K>
+inline int count_less_equal(const K *keys, int n, K key)
+{
+    if (key == std::numeric_limits<K>::max())
+        return n;
+    return count_less(keys, n, key + 1);
+}
+
+// Lower bound over a sorted array of any length, a branchless binary search
+// narrows it to a window of at most 64 keys which is then counted in vectors
+template <typename K>
+inline int sorted_lower_bound(const K *keys, int n, K key)
+{
+    auto base = keys;
+    while (n > 64)
+    {
+        auto half = n / 2;
+        base = base[half - 1] < key ? base + half : base;
+        n -= half;
+    }
+    return (base - keys) + count_less(base, n, key);
+}
+
+template <typename K>
+inline int sorted_upper_bound(const K *keys, int n, K key)
+{
+    if (key == std::numeric_limits<K>::max())
+        return n;
+    return sorted_lower_bound(keys, n, key + 1);
+}
+
+#endif
@@ -1,222 +1,1123 @@
 #ifndef SKIP_LIST_H
-#define SKIP_LIST_H 
+#define SKIP_LIST_H
 
 /*
     Skip list class
-    Written by Dylan Janssen 
+    Written by Dylan Janssen
     Developed as a teaching execise
-    Skip lists improve search performance of linked lists by 
-    skipping over sections of data to become comparable to binary 
+    Skip lists improve search performance of linked lists by
+    skipping over sections of data to become comparable to binary
     search trees
+    Nodes come from alloc_T, see node_pool.hpp
+    Each node's tower of forward pointers is stored inline right after
+    the node, sized by its level, so a node is a single allocation and
+    searches keep their update path in a fixed size array on the stack
+    Level 0 is also linked backwards so iterators can walk either way
+    Each forward pointer also records how many nodes it skips, which
+    gives rank and select by summing widths along a search path
+    The probability of a node growing another level and the cap on levels
+    are set per list, levels are drawn from the list's own xorshift
+    generator. Inserts and erases keep a running average of the links
+    their searches take. When the towers have drifted far enough from the
+    reconfigure() layout for that to exceed the layout's cost by half,
+    every insert and erase rebuilds the towers of the next few nodes in
+    that layout until a full pass is done, so the list is brought back to
+    the optimum under churn in bounded steps. Those steps move nodes, so
+    an insert or erase may leave iterators to other keys dangling while
+    one is under way; auto_rebalance(false) turns it off.
+    Inserts and erases keep the update path of the last one as a finger
+    and start the next search from it, climbing only as high as the
+    distance between the keys needs, so keys near the last one (appends
+    in key order above all) are found in O(log d) steps rather than
+    O(log n). Readers keep their own Finger for lookup(key, finger).
+    find_many runs a batch of searches in lockstep, see lockstep.hpp.
+    Bulk loads, for_each, reduce and clear can split the list into runs of
+    positions and work on one run per thread, see fork_join.hpp. The
+    layout gives every node its level from its position alone, so each
+    run is built on its own and the runs are stitched together level by
+    level where they meet.
 */
 
-#include <string> 
-#include <vector> 
-#include <iostream> 
-#include "map.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <iostream>
+#include <iterator>
+#include "ordered_map.hpp"
+#include "node_pool.hpp"
+#include "lockstep.hpp"
+#include "fork_join.hpp"
 
 
-template <typename T> 
-class SkipList : public Map<T>
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename alloc_T = PoolAllocator>
+class SkipList : public OrderedMap<T, Key, Compare>
 {
-private: 
-    struct SkipNode 
+private:
+    using order = KeyOrder<Key, Compare>;
+    static constexpr int max_level = 32;
+    struct alignas(void*) SkipNode
     {
-        int key; 
-        T value; 
-        std::vector<SkipNode*> forward; 
-        SkipNode(int k, const T &v) : key(k), value(v) {} 
+        Key key;
+        T value;
+        int level; // number of forward pointers in the tower
+        SkipNode *prev; // the node before on level 0, head for the first node
+        template <typename... Args>
+        SkipNode(int l, const Key &k, Args &&...args) : key(k), value(std::forward<Args>(args)...), level(l), prev(nullptr) {}
+        SkipNode*& next(int i) { return reinterpret_cast<SkipNode**>(this + 1)[i]; }
+        // level 0 steps next(i) covers, a null link covers those to one past the last node
+        int& width(int i) { return reinterpret_cast<int*>(&next(level))[i]; }
+        static std::size_t bytes(int level) { return sizeof(SkipNode) + level * (sizeof(SkipNode*) + sizeof(int)); }
     };
-    SkipNode *head, *NIL; 
-    double probability; 
-    int random_level(); 
-    int node_level(const std::vector<SkipNode*> &v) const { return v.size() - 1; }
+    static constexpr int rebalance_nodes = 8;     // nodes a rebalance step rebuilds per insert or erase
+    static constexpr int rebalance_interval = 64; // inserts and erases between drift checks, and the span of the average
+    static constexpr int find_group = 8;          // searches find_many keeps in flight
+    SkipNode *head; // tower of max_level pointers, nullptr ends every level
+    alloc_T alloc;
+    double probability;
+    std::uint32_t threshold; // a 32 bit draw below this grows a level
+    int level_cap;
+    int fanout; // the layout gives every fanout-th node of a level the next one too
+    std::uint64_t state; // xorshift
+    mutable ShapeCounters counters;
+    int level; // levels in use, the height of the tallest node
     int sz;
-    SkipNode* find(int key, std::vector<SkipNode*> &update); 
-public: 
-    SkipList(); 
-    void insert(int key, const T &value) override; 
-    bool find(int key, T &value) override; 
-    void erase(int key) override; 
+    long towers[max_level + 1]; // towers[h] nodes are h levels high
+    double path_average; // links followed by recent inserts and erases
+    bool rebalance;
+    bool rebalancing; // a pass is under way
+    int rebalance_pos; // position of the next node the pass rebuilds, from 1
+    int until_check;
+    // the update path of the last insert or erase and its positions, kept
+    // exact while fingered, anything else that relinks nodes drops it
+    SkipNode *finger[max_level];
+    int finger_ranks[max_level];
+    bool fingered;
+    std::uint64_t frees; // nodes freed so far, a reader's Finger is stale once this moves
+    std::uint64_t next_random();
+    int random_level();
+    template <typename... Args>
+    static SkipNode* make_node(alloc_T &alloc, int level, const Key &key, Args &&...args);
+    void free_node(SkipNode *x);
+    int resume(const Key &key, SkipNode *const *path) const;
+    SkipNode* search(const Key &key);
+    SkipNode* bound_node(const Key &key, bool inclusive) const;
+    SkipNode* select_node(int k) const;
+    SkipNode* last_node() const;
+    void link(SkipNode *x, SkipNode **update, int *ranks);
+    void unlink(SkipNode *x, SkipNode **update);
+    int layout_levels(int n) const;
+    int layout_level(int p, int levels) const;
+    double layout_path(int n) const;
+    bool drifted() const;
+    void maintain();
+    void rebalance_step();
+    // Nodes built from a run of items and linked among themselves. first and
+    // last are the run's first and last node on each level and their
+    // positions, levels no node of the run reaches are left out
+    struct Run
+    {
+        SkipNode *first[max_level], *last[max_level];
+        int first_pos[max_level], last_pos[max_level];
+        long towers[max_level + 1];
+        int level;
+    };
+    void build_run(alloc_T &alloc, const std::vector<std::pair<Key, T>> &items, const std::vector<int> *heights, int levels, int lo, int hi, Run &run) const;
+    void build(const std::vector<std::pair<Key, T>> &items, const std::vector<int> *heights, bool parallel = false);
+    void teardown(SkipNode *x);
+public:
+    using Visitor = typename OrderedMap<T, Key, Compare>::Visitor;
+    // p is the chance of a node growing each further level, up to max_levels
+    explicit SkipList(double p = 0.5, int max_levels = max_level);
+    SkipList(const SkipList &) = delete;
+    SkipList& operator=(const SkipList &) = delete;
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    T* lookup(const Key &key) override;
+    // Where a reader's last lookup went. A lookup with it starts from
+    // there, and it falls back to a full search once nodes have been freed
+    class Finger
+    {
+    private:
+        SkipNode *path[max_level];
+        int levels = 0;
+        std::uint64_t frees = 0;
+        friend class SkipList;
+    };
+    T* lookup(const Key &key, Finger &finger);
+    // lookup(keys[i]) into out[i] for every key with find_group searches
+    // in flight at once, returns the number found
+    int find_many(const std::vector<Key> &keys, std::vector<T*> &out);
+    int find_batch(const std::vector<Key> &keys, std::vector<T> &values, std::vector<bool> &found) override { return find_batch_by_many(*this, keys, values, found); }
+    template <typename... Args>
+    std::pair<T*, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    void clear() override;
+    // parallel frees a run of the nodes per thread
+    void clear(bool parallel);
+    void insert_batch(const std::vector<std::pair<Key, T>> &items) override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override { build(items, nullptr); }
+    // the level count of each node in key order, and a bulk load that
+    // gives node i heights[i] levels, so a saved list comes back the same
+    std::vector<int> tower_heights() const;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items, const std::vector<int> &heights) { build(items, &heights); }
+    // parallel builds a run of the items per thread
+    void bulk_load(const std::vector<std::pair<Key, T>> &items, bool parallel) { build(items, nullptr, parallel); }
+    void range(const Key &lo, const Key &hi, Visitor visit) const override;
+    void for_each(Visitor visit) const override;
+    // parallel visits a run of keys per thread, each run in order but the
+    // runs at once, so visit must be safe to call from several threads
+    template <typename Visit>
+    void for_each(Visit visit, bool parallel) const;
+    // Folds get(key, value) over the keys in order with combine, which
+    // must be associative, parallel as for for_each
+    template <typename R, typename Get, typename Combine>
+    R reduce(const R &identity, Get get, Combine combine, bool parallel = false) const;
+    bool lower_bound(const Key &key, Key &found, T &value) const override;
+    bool upper_bound(const Key &key, Key &found, T &value) const override;
+    int rank(const Key &key) const override;
+    bool select(int k, Key &found, T &value) const override;
+    MemoryUsage memory_usage() const override;
+    // the level histogram display_levels() draws, and the counters
+    ShapeStats shape_stats() const override;
+    void reset_counters() override { counters.reset(); }
     void display_levels();
-    void reconfigure(); 
-    int get_highest_level() { return node_level(head->forward); }
+    void reconfigure();
+    void seed(std::uint64_t s) { state = s | 1; }
+    void auto_rebalance(bool on);
+    bool is_rebalancing() const { return rebalancing; }
+    double get_probability() const { return probability; }
+    int get_max_level() const { return level_cap; }
+    int get_highest_level() { return level; }
     int size() { return sz; }
-    ~SkipList(); 
-    template <typename U> 
-    friend std::ostream& operator<<(std::ostream &os, const SkipList<U> &list); 
+    ~SkipList();
+    template <typename U, typename K, typename C, typename A>
+    friend std::ostream& operator<<(std::ostream &os, const SkipList<U, K, C, A> &list);
+
+    class Iterator
+    {
+    private:
+        SkipNode *node;
+        const SkipList *list; // end() is nullptr, decrementing it needs the last node
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = OrderedEntry<T, Key>;
+        Iterator(SkipNode *n, const SkipList *l) : node(n), list(l) {}
+        Iterator& operator++()
+        {
+            node = node->next(0);
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            auto temp = *this;
+            ++*this;
+            return temp;
+        }
+        Iterator& operator--()
+        {
+            node = node != nullptr ? node->prev : list->last_node();
+            return *this;
+        }
+        Iterator operator--(int)
+        {
+            auto temp = *this;
+            --*this;
+            return temp;
+        }
+        reference operator*() const { return reference(node->key, node->value); }
+        bool operator==(const Iterator &rhs) const { return node == rhs.node; }
+        bool operator!=(const Iterator &rhs) const { return node != rhs.node; }
+    };
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const { return Iterator(head->next(0), this); }
+    Iterator end() const { return Iterator(nullptr, this); }
+    ReverseIterator rbegin() const { return ReverseIterator(end()); }
+    ReverseIterator rend() const { return ReverseIterator(begin()); }
+    Iterator lower_bound(const Key &key) const { return Iterator(bound_node(key, true), this); }
+    Iterator upper_bound(const Key &key) const { return Iterator(bound_node(key, false), this); }
+    Iterator select(int k) const { return Iterator(select_node(k), this); }
 };
 
-template <typename T> 
-SkipList<T>::SkipList() : probability(0.5), sz(0)
+template <typename T, typename Key, typename Compare, typename alloc_T>
+SkipList<T, Key, Compare, alloc_T>::SkipList(double p, int max_levels)
+    : probability(p), level_cap(max_levels), level(0), sz(0), towers{}, path_average(0), rebalance(true), rebalancing(false), rebalance_pos(1), until_check(rebalance_interval), fingered(false), frees(0)
+{
+    if (!(p > 0 && p <= 0.5))
+        throw std::invalid_argument("SkipList: probability must be above 0 and at most 0.5");
+    if (max_levels < 1 || max_levels > max_level)
+        throw std::invalid_argument("SkipList: max_levels must be between 1 and " + std::to_string(max_level));
+    threshold = std::uint32_t(std::ldexp(p, 32));
+    fanout = std::max(2, int(std::lround(1 / p)));
+    seed(0x9E3779B97F4A7C15ull ^ reinterpret_cast<std::uintptr_t>(this));
+    head = make_node(alloc, max_level, Key());
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+template <typename... Args>
+typename SkipList<T, Key, Compare, alloc_T>::SkipNode* SkipList<T, Key, Compare, alloc_T>::make_node(alloc_T &alloc, int level, const Key &key, Args &&...args)
+{
+    auto bytes = SkipNode::bytes(level);
+    auto *p = alloc.allocate(bytes);
+    SkipNode *x;
+    try
+    {
+        x = new (p) SkipNode(level, key, std::forward<Args>(args)...);
+    }
+    catch (...)
+    {
+        alloc.deallocate(p, bytes);
+        throw;
+    }
+    for (int i = 0; i < level; i++)
+    {
+        x->next(i) = nullptr;
+        x->width(i) = 0;
+    }
+    return x;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::free_node(SkipNode *x)
+{
+    auto bytes = SkipNode::bytes(x->level);
+    x->~SkipNode();
+    alloc.deallocate(x, bytes);
+    frees++;
+}
+
+// xorshift64*, a few cycles a draw and no shared state between lists
+template <typename T, typename Key, typename Compare, typename alloc_T>
+std::uint64_t SkipList<T, Key, Compare, alloc_T>::next_random()
 {
-    head = new SkipNode(std::numeric_limits<int>::min(), "HEAD");
-    NIL  = new SkipNode(std::numeric_limits<int>::max(), "NIL");
-    head->forward.emplace_back(NIL); 
-    NIL->forward.emplace_back(nullptr); 
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545F4914F6CDD1Dull;
 }
 
-template <typename T> 
-int SkipList<T>::random_level()
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::random_level()
 {
-    auto v = 1; 
-    while (double(rand()) / RAND_MAX < probability)
-        v++; 
-    return v; 
+    auto v = 1;
+    while (v < level_cap && std::uint32_t(next_random() >> 32) < threshold)
+        v++;
+    return v;
 }
 
-template <typename T> 
-typename SkipList<T>::SkipNode* SkipList<T>::find(int key, std::vector<SkipList<T>::SkipNode*> &update) 
+// The level of path, the last nodes before an earlier key on each level,
+// that a search for key can start from, or -1 to start from head. Going
+// forward it climbs while the next node on the level is still before key,
+// going back until the node on the level is before key, so it climbs about
+// log d levels for keys d apart. Every level above the one it stops at
+// already has its last node before key in path
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::resume(const Key &key, SkipNode *const *path) const
 {
-    auto x = head; 
-    auto current_maximum = node_level(head->forward); 
-    for (int i = current_maximum; i >= 0; i--)
+    auto l = 0;
+    if (path[0] == head || order::less(path[0]->key, key))
     {
-        while (x->forward[i] != nullptr && x->forward[i]->key < key) 
-            x = x->forward[i]; 
-        update[i] = x; 
+        while (l + 1 < level && path[l]->next(l) != nullptr && order::less(path[l]->next(l)->key, key))
+            l++;
+        return l;
     }
-    if (x->forward[0]->key == key) 
-        return x->forward[0]; 
-    return nullptr; 
+    while (l + 1 < level && path[l] != head && !order::less(path[l]->key, key))
+        l++;
+    return path[l] == head || order::less(path[l]->key, key) ? l : -1;
 }
 
-template <typename T> 
-bool SkipList<T>::find(int key, T &value)
+// Fills finger with the last node before key on each level and
+// finger_ranks with their positions, head being 0, starting from the
+// finger of the last insert or erase when there is one
+template <typename T, typename Key, typename Compare, typename alloc_T>
+typename SkipList<T, Key, Compare, alloc_T>::SkipNode* SkipList<T, Key, Compare, alloc_T>::search(const Key &key)
 {
-    std::vector<SkipNode*> update(head->forward);
-    auto x = find(key, update); 
-    if (x != nullptr) 
+    auto probe = counters.probe();
+    auto before = [&](SkipNode *y) { probe.compare(); return order::less(y->key, key); };
+    auto update = finger;
+    auto ranks = finger_ranks;
+    auto top = fingered && level > 0 ? resume(key, finger) : -1;
+    auto x = top < 0 ? head : finger[top];
+    auto r = top < 0 ? 0 : finger_ranks[top];
+    auto steps = 0;
+    fingered = true;
+    for (int i = top < 0 ? level - 1 : top; i >= 0; i--)
     {
-        value = x->value; 
-        return true; 
+        while (x->next(i) != nullptr && before(x->next(i)))
+        {
+            probe.step();
+            steps++;
+            r += x->width(i);
+            x = x->next(i);
+        }
+        update[i] = x;
+        ranks[i] = r;
     }
-    return false; 
+    path_average += (steps - path_average) / rebalance_interval;
+    x = x->next(0);
+    if (x == nullptr)
+        return nullptr;
+    probe.step();
+    probe.compare();
+    return order::equal(x->key, key) ? x : nullptr;
+}
+
+// The first node with a key >= key when inclusive, > key otherwise
+template <typename T, typename Key, typename Compare, typename alloc_T>
+typename SkipList<T, Key, Compare, alloc_T>::SkipNode* SkipList<T, Key, Compare, alloc_T>::bound_node(const Key &key, bool inclusive) const
+{
+    auto x = head;
+    for (int i = level - 1; i >= 0; i--)
+        while (x->next(i) != nullptr && (inclusive ? order::less(x->next(i)->key, key) : !order::less(key, x->next(i)->key)))
+            x = x->next(i);
+    return x->next(0);
 }
 
-template <typename T> 
-void SkipList<T>::insert(int key, const T &value) 
+template <typename T, typename Key, typename Compare, typename alloc_T>
+typename SkipList<T, Key, Compare, alloc_T>::SkipNode* SkipList<T, Key, Compare, alloc_T>::last_node() const
 {
-    std::vector<SkipNode*> update(head->forward); 
-    auto x = find(key, update);
-    if (x != nullptr) 
+    auto x = head;
+    for (int i = level - 1; i >= 0; i--)
+        while (x->next(i) != nullptr)
+            x = x->next(i);
+    return x == head ? nullptr : x;
+}
+
+// Links x in after the nodes in update on each of its levels, raising the
+// list's level to x's. ranks holds the positions of the nodes in update,
+// the links x splits share their width with it and those above it grow by one
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::link(SkipNode *x, SkipNode **update, int *ranks)
+{
+    for (auto i = level; i < x->level; i++)
     {
-        x->value = value; 
-        return; 
+        update[i] = head;
+        ranks[i] = 0;
+        head->width(i) = sz + 1;
     }
-    auto new_node_level = random_level(); 
-    auto current_level = node_level(update); 
-    for (auto i = current_level + 1; i <= new_node_level; i++)
-        update.emplace_back(head); 
-    x = new SkipNode(key, value); 
-    for (auto i = 0; i < new_node_level; i++)
+    level = std::max(level, x->level);
+    auto r = ranks[0] + 1;
+    for (auto i = 0; i < x->level; i++)
     {
-        x->forward.emplace_back(nullptr); 
-        if (head->forward.size() <= x->forward.size())
-            head->forward.emplace_back(NIL); 
+        x->next(i) = update[i]->next(i);
+        update[i]->next(i) = x;
+        x->width(i) = update[i]->width(i) - (r - ranks[i]) + 1;
+        update[i]->width(i) = r - ranks[i];
     }
-    for (auto i = 0; i < new_node_level; i++)
+    for (auto i = x->level; i < level; i++)
+        update[i]->width(i)++;
+    x->prev = update[0];
+    if (x->next(0) != nullptr)
+        x->next(0)->prev = x;
+    towers[x->level]++;
+    sz++;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+T* SkipList<T, Key, Compare, alloc_T>::lookup(const Key &key)
+{
+    auto probe = counters.probe();
+    auto before = [&](SkipNode *y) { probe.compare(); return order::less(y->key, key); };
+    auto x = head;
+    for (int i = level - 1; i >= 0; i--)
+        while (x->next(i) != nullptr && before(x->next(i)))
+        {
+            probe.step();
+            x = x->next(i);
+        }
+    x = x->next(0);
+    if (x == nullptr)
+        return nullptr;
+    probe.step();
+    probe.compare();
+    return order::equal(x->key, key) ? &x->value : nullptr;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+T* SkipList<T, Key, Compare, alloc_T>::lookup(const Key &key, Finger &f)
+{
+    auto probe = counters.probe();
+    auto before = [&](SkipNode *y) { probe.compare(); return order::less(y->key, key); };
+    auto top = f.levels == level && f.frees == frees && level > 0 ? resume(key, f.path) : -1;
+    auto x = top < 0 ? head : f.path[top];
+    for (int i = top < 0 ? level - 1 : top; i >= 0; i--)
     {
-        x->forward[i] = update[i]->forward[i];
-        update[i]->forward[i] = x;  
+        while (x->next(i) != nullptr && before(x->next(i)))
+        {
+            probe.step();
+            x = x->next(i);
+        }
+        f.path[i] = x;
     }
-    sz++;
+    f.levels = level;
+    f.frees = frees;
+    x = x->next(0);
+    if (x == nullptr)
+        return nullptr;
+    probe.step();
+    probe.compare();
+    return order::equal(x->key, key) ? &x->value : nullptr;
+}
+
+// Each step follows or drops below one link of one search and prefetches
+// the node that search compares with next, which is not read until every
+// other search in the group has taken its step
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::find_many(const std::vector<Key> &keys, std::vector<T*> &out)
+{
+    struct Search
+    {
+        SkipNode *node;
+        int level;
+        std::size_t i;
+        long steps, compares;
+    };
+    out.assign(keys.size(), nullptr);
+    int count = 0;
+    auto start = [&](Search &s, std::size_t i) { s = {head, level - 1, i, 0, 0}; };
+    auto step = [&](Search &s) {
+        auto y = s.level < 0 ? nullptr : s.node->next(s.level);
+        if (y != nullptr)
+        {
+            s.compares++;
+            if (order::less(y->key, keys[s.i]))
+            {
+                s.steps++;
+                s.node = y;
+                prefetch_node(y->next(s.level));
+                return false;
+            }
+        }
+        if (s.level > 0)
+        {
+            s.level--;
+            prefetch_node(s.node->next(s.level));
+            return false;
+        }
+        // y is the first node at or after the key
+        auto probe = counters.probe();
+        probe.step(s.steps);
+        probe.compare(s.compares);
+        if (y != nullptr)
+        {
+            probe.step();
+            probe.compare();
+            if (order::equal(y->key, keys[s.i]))
+            {
+                out[s.i] = &y->value;
+                count++;
+            }
+        }
+        return true;
+    };
+    in_lockstep<find_group, Search>(keys.size(), start, step);
+    return count;
 }
 
-template <typename T> 
-void SkipList<T>::erase(int key)
+// The finger stays exact through both: the nodes before key are the same
+// ones after key is linked in or taken out
+template <typename T, typename Key, typename Compare, typename alloc_T>
+template <typename... Args>
+std::pair<T*, bool> SkipList<T, Key, Compare, alloc_T>::emplace(const Key &key, Args &&...args)
 {
-    std::vector<SkipNode*> update(head->forward); 
-    auto x = find(key, update);
-    if (x != nullptr && x->key == key)
+    maintain(); // first, as a step may move the node returned
+    auto x = search(key);
+    if (x != nullptr)
+        return {&x->value, false};
+    x = make_node(alloc, random_level(), key, std::forward<Args>(args)...);
+    link(x, finger, finger_ranks);
+    counters.update();
+    return {&x->value, true};
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::erase(const Key &key)
+{
+    maintain();
+    auto x = search(key);
+    if (x != nullptr)
+    {
+        unlink(x, finger);
+        free_node(x);
+        counters.update();
+    }
+}
+
+// Takes x out of every level, update holding the nodes before it
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::unlink(SkipNode *x, SkipNode **update)
+{
+    for (int i = 0; i < x->level; i++)
+    {
+        update[i]->next(i) = x->next(i);
+        update[i]->width(i) += x->width(i) - 1;
+    }
+    for (int i = x->level; i < level; i++)
+        update[i]->width(i)--;
+    if (x->next(0) != nullptr)
+        x->next(0)->prev = x->prev;
+    while (level > 0 && head->next(level-1) == nullptr)
+        level--;
+    towers[x->level]--;
+    sz--;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::clear()
+{
+    auto x = head->next(0);
+    while (x != nullptr)
     {
-        for (int i = 0; i < update.size() && update[i]->forward[i] == x; i++)
-            update[i]->forward[i] = x->forward[i]; 
-        delete x; 
-        while (head->forward[head->forward.size()-2] == NIL)
-            head->forward.pop_back(); 
-        sz--;
+        auto next = x->next(0);
+        free_node(x);
+        x = next;
     }
+    for (int i = 0; i < max_level; i++)
+        head->next(i) = nullptr;
+    level = 0;
+    sz = 0;
+    std::fill(towers, towers + max_level + 1, 0);
+    rebalancing = false;
+    fingered = false;
 }
 
-template <typename T> 
-void SkipList<T>::display_levels()
+// free_node for one of the threads of a parallel clear, see teardown_node
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::teardown(SkipNode *x)
 {
-    for (int i = node_level(head->forward); i >= 0; i--)
+    auto bytes = SkipNode::bytes(x->level);
+    x->~SkipNode();
+    if constexpr (!alloc_T::releases_all)
+        alloc.deallocate(x, bytes);
+}
+
+// Every thread frees the nodes from the start of its run up to the next
+// run's. A pool that gives all of its chunks back takes head with it, so
+// a new one is made
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::clear(bool parallel)
+{
+    auto pieces = parallel_pieces(sz, parallel);
+    if constexpr (!parallel_teardown<alloc_T>)
+        pieces = 1;
+    if (pieces == 1)
     {
-        auto x = head; 
-        while (x->forward[0] != nullptr)
+        clear();
+        return;
+    }
+    std::vector<SkipNode*> starts(pieces + 1);
+    for (int j = 0; j < pieces; j++)
+        starts[j] = select_node(piece_begin(sz, pieces, j));
+    run_pieces(pieces, [&](int j) {
+        for (auto x = starts[j]; x != starts[j + 1];)
         {
-            if (node_level(x->forward) >= i)
-                std::cout << '-';
-            else 
-                std::cout << ' ';
-            x = x->forward[0]; 
+            auto next = x->next(0);
+            teardown(x);
+            x = next;
         }
-        std::cout << std::endl; 
+    });
+    if constexpr (alloc_T::releases_all)
+    {
+        head->~SkipNode();
+        alloc.release();
+        head = make_node(alloc, max_level, Key());
     }
+    head->next(0) = nullptr;
+    frees++;
+    clear();
 }
 
-template <typename T> 
-void SkipList<T>::reconfigure() 
+// Sorted keys only move forward, so each search resumes from the previous
+// key's update path rather than starting again at the top of head
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::insert_batch(const std::vector<std::pair<Key, T>> &items)
 {
-    // clear all levels except 0 
-    auto x = head; 
-    while (x->forward[0] != nullptr) 
+    auto by_key = [](const std::pair<Key, T> &a, const std::pair<Key, T> &b) { return order::less(a.first, b.first); };
+    std::vector<std::pair<Key, T>> sorted;
+    const auto *batch = &items;
+    if (!std::is_sorted(items.begin(), items.end(), by_key))
     {
-        x->forward.erase(x->forward.begin()+1, x->forward.end());
-        x = x->forward[0]; 
+        sorted = items;
+        std::stable_sort(sorted.begin(), sorted.end(), by_key);
+        batch = &sorted;
     }
-    for (int step = 2; step < sz; step *= 2) 
+    SkipNode *update[max_level];
+    int ranks[max_level] = {};
+    std::fill(update, update + max_level, head);
+    fingered = false;
+    for (const auto &[key, value] : *batch)
     {
-        x = head; 
-        auto prev = head; 
-        bool done = false; 
-        while (!done) 
+        auto x = head;
+        auto r = 0;
+        for (int i = level - 1; i >= 0; i--)
         {
-            // move x step times forward 
-            for (int i = 0; i < step; i++)
+            if (update[i] != head && (x == head || order::less(x->key, update[i]->key)))
             {
-                if (x->forward[0] != nullptr)
-                    x = x->forward[0]; 
-                else 
-                    done = true; 
+                x = update[i];
+                r = ranks[i];
             }
-            if (!done) 
+            while (x->next(i) != nullptr && order::less(x->next(i)->key, key))
             {
-                prev->forward.emplace_back(x);
-                prev = x; 
+                r += x->width(i);
+                x = x->next(i);
             }
+            update[i] = x;
+            ranks[i] = r;
         }
-        prev->forward.emplace_back(nullptr); 
+        if (x->next(0) != nullptr && order::equal(x->next(0)->key, key))
+        {
+            x->next(0)->value = value;
+            continue;
+        }
+        link(make_node(alloc, random_level(), key, value), update, ranks);
+        counters.update();
     }
-    head->forward.emplace_back(NIL); 
 }
 
-template <typename T> 
-SkipList<T>::~SkipList()
+// Number of levels in the layout reconfigure() builds for n nodes
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::layout_levels(int n) const
 {
-    auto x = head; 
-    while (x != nullptr)
+    auto levels = 1;
+    for (long span = fanout; levels < level_cap && span < n; span *= fanout)
+        levels++;
+    return levels;
+}
+
+// The node at position p (counting from 1) gets one level for every power
+// of fanout dividing p
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::layout_level(int p, int levels) const
+{
+    auto l = 1;
+    for (; l < levels && p % fanout == 0; p /= fanout)
+        l++;
+    return l;
+}
+
+// Links a search takes in the layout, on average half of the fanout - 1 a
+// level below the top can take and half of the top level, which is long
+// when the level cap cuts the layout short
+template <typename T, typename Key, typename Compare, typename alloc_T>
+double SkipList<T, Key, Compare, alloc_T>::layout_path(int n) const
+{
+    auto levels = layout_levels(n);
+    auto top = double(n);
+    for (int l = 1; l < levels; l++)
+        top /= fanout;
+    return ((levels - 1) * (fanout - 1) + top) / 2.0;
+}
+
+// A random list takes about twice the layout's links, and erases that take
+// the tall towers out of a region leave long runs at its lower levels.
+// Small lists and lists of one level are left alone, there is nothing
+// to gain
+template <typename T, typename Key, typename Compare, typename alloc_T>
+bool SkipList<T, Key, Compare, alloc_T>::drifted() const
+{
+    return level_cap > 1 && sz >= rebalance_interval && path_average > 1.5 * layout_path(sz) + 1;
+}
+
+// Called by every insert and erase: checks for drift now and then, and
+// while a pass is under way moves it on one step
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::maintain()
+{
+    if (!rebalance)
+        return;
+    if (!rebalancing && --until_check <= 0)
     {
-        auto next = x->forward[0]; 
-        delete x; 
-        x = next; 
+        until_check = rebalance_interval;
+        if (drifted())
+        {
+            rebalancing = true;
+            rebalance_pos = 1;
+        }
     }
+    if (rebalancing)
+        rebalance_step();
 }
 
-template <typename U> 
-std::ostream& operator<<(std::ostream &os, const SkipList<U> &list) 
+// Gives the next rebalance_nodes nodes from rebalance_pos the heights of the
+// layout. The pass works by position, so it finds its place again with a
+// descent by width rather than holding pointers between operations
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::rebalance_step()
 {
-    auto x = list.head->forward[0]; 
-    while (x->key != std::numeric_limits<int>::max())
+    SkipNode *update[max_level];
+    int ranks[max_level];
+    fingered = false;
+    auto x = head;
+    auto r = 0;
+    for (int i = max_level - 1; i >= 0; i--)
+    {
+        while (i < level && x->next(i) != nullptr && r + x->width(i) < rebalance_pos)
+        {
+            r += x->width(i);
+            x = x->next(i);
+        }
+        update[i] = x;
+        ranks[i] = r;
+    }
+    auto levels = layout_levels(sz);
+    x = x->next(0);
+    for (int done = 0; done < rebalance_nodes && x != nullptr; done++)
+    {
+        auto l = layout_level(rebalance_pos, levels);
+        if (x->level != l)
+        {
+            auto y = make_node(alloc, l, x->key, std::move(x->value));
+            unlink(x, update);
+            free_node(x);
+            link(y, update, ranks);
+            x = y;
+        }
+        for (int i = 0; i < x->level; i++)
+        {
+            update[i] = x;
+            ranks[i] = rebalance_pos;
+        }
+        rebalance_pos++;
+        x = x->next(0);
+    }
+    if (x == nullptr) // the pass is done
+    {
+        rebalancing = false;
+        rebalance_pos = 1;
+        until_check = rebalance_interval;
+        path_average = layout_path(sz);
+    }
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::auto_rebalance(bool on)
+{
+    rebalance = on;
+    rebalancing = false;
+    until_check = rebalance_interval;
+}
+
+// Links the sorted items[lo, hi) in one pass, each node's height taken from
+// heights or when that is null from the layout reconfigure() builds.
+// Positions are counted from 1 over all the items, the run's first node
+// is left with no prev and its last ones with no next until it is stitched
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::build_run(alloc_T &alloc, const std::vector<std::pair<Key, T>> &items, const std::vector<int> *heights, int levels, int lo, int hi, Run &run) const
+{
+    std::fill(run.first, run.first + max_level, nullptr);
+    std::fill(run.last, run.last + max_level, nullptr);
+    std::fill(run.towers, run.towers + max_level + 1, 0);
+    run.level = 0;
+    for (int p = lo + 1; p <= hi; p++)
+    {
+        auto l = heights == nullptr ? layout_level(p, levels) : std::clamp((*heights)[p-1], 1, level_cap);
+        auto x = make_node(alloc, l, items[p-1].first, items[p-1].second);
+        run.towers[l]++;
+        x->prev = run.last[0];
+        for (int i = 0; i < l; i++)
+        {
+            if (run.last[i] == nullptr)
+            {
+                run.first[i] = x;
+                run.first_pos[i] = p;
+            }
+            else
+            {
+                run.last[i]->next(i) = x;
+                run.last[i]->width(i) = p - run.last_pos[i];
+            }
+            run.last[i] = x;
+            run.last_pos[i] = p;
+        }
+        run.level = std::max(run.level, l);
+    }
+}
+
+// A parallel build gives every run an allocator of its own, which this
+// list's adopts once they are built
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::build(const std::vector<std::pair<Key, T>> &items, const std::vector<int> *heights, bool parallel)
+{
+    clear();
+    int n = items.size();
+    auto levels = layout_levels(n);
+    auto pieces = parallel_pieces(n, parallel);
+    std::vector<Run> runs(pieces);
+    std::vector<alloc_T> allocs(pieces == 1 ? 0 : pieces);
+    run_pieces(pieces, [&](int j) {
+        build_run(pieces == 1 ? alloc : allocs[j], items, heights, levels, piece_begin(n, pieces, j), piece_begin(n, pieces, j + 1), runs[j]);
+    });
+    for (auto &part : allocs)
+        alloc.adopt(std::move(part));
+    SkipNode *last[max_level];
+    int last_pos[max_level] = {};
+    std::fill(last, last + max_level, head);
+    for (auto &run : runs)
+    {
+        if (run.level == 0)
+            continue;
+        run.first[0]->prev = last[0];
+        for (int i = 0; i < run.level; i++)
+        {
+            last[i]->next(i) = run.first[i];
+            last[i]->width(i) = run.first_pos[i] - last_pos[i];
+            last[i] = run.last[i];
+            last_pos[i] = run.last_pos[i];
+        }
+        for (int l = 1; l <= max_level; l++)
+            towers[l] += run.towers[l];
+        level = std::max(level, run.level);
+    }
+    for (int i = 0; i < max_level; i++)
+        last[i]->width(i) = n + 1 - last_pos[i];
+    sz = n;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+std::vector<int> SkipList<T, Key, Compare, alloc_T>::tower_heights() const
+{
+    std::vector<int> heights;
+    heights.reserve(sz);
+    for (auto x = head->next(0); x != nullptr; x = x->next(0))
+        heights.push_back(x->level);
+    return heights;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::range(const Key &lo, const Key &hi, Visitor visit) const
+{
+    for (auto x = bound_node(lo, true); x != nullptr && order::less(x->key, hi); x = x->next(0))
+        visit(x->key, x->value);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::for_each(Visitor visit) const
+{
+    for (auto x = head->next(0); x != nullptr; x = x->next(0))
+        visit(x->key, x->value);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+template <typename Visit>
+void SkipList<T, Key, Compare, alloc_T>::for_each(Visit visit, bool parallel) const
+{
+    walk_pieces(
+        sz, parallel_pieces(sz, parallel), [this](int k) { return select_node(k); }, [](SkipNode *x) { return x->next(0); },
+        [&](int, SkipNode *x) { visit(x->key, x->value); });
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+template <typename R, typename Get, typename Combine>
+R SkipList<T, Key, Compare, alloc_T>::reduce(const R &identity, Get get, Combine combine, bool parallel) const
+{
+    return reduce_pieces(
+        sz, parallel_pieces(sz, parallel), identity, [this](int k) { return select_node(k); }, [](SkipNode *x) { return x->next(0); },
+        [&](SkipNode *x) { return get(x->key, x->value); }, combine);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+bool SkipList<T, Key, Compare, alloc_T>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto x = bound_node(key, true);
+    if (x == nullptr)
+        return false;
+    found = x->key;
+    value = x->value;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+bool SkipList<T, Key, Compare, alloc_T>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto x = bound_node(key, false);
+    if (x == nullptr)
+        return false;
+    found = x->key;
+    value = x->value;
+    return true;
+}
+
+// Sums the widths of the links a search for key takes
+template <typename T, typename Key, typename Compare, typename alloc_T>
+int SkipList<T, Key, Compare, alloc_T>::rank(const Key &key) const
+{
+    auto x = head;
+    auto r = 0;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->next(i) != nullptr && order::less(x->next(i)->key, key))
+        {
+            r += x->width(i);
+            x = x->next(i);
+        }
+    }
+    return r;
+}
+
+// Takes every link that does not overshoot position k + 1, nullptr (the end) when there are k or fewer nodes
+template <typename T, typename Key, typename Compare, typename alloc_T>
+typename SkipList<T, Key, Compare, alloc_T>::SkipNode* SkipList<T, Key, Compare, alloc_T>::select_node(int k) const
+{
+    if (k < 0 || k >= sz)
+        return nullptr;
+    auto x = head;
+    auto r = 0;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->next(i) != nullptr && r + x->width(i) <= k + 1)
+        {
+            r += x->width(i);
+            x = x->next(i);
+        }
+    }
+    return x;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+bool SkipList<T, Key, Compare, alloc_T>::select(int k, Key &found, T &value) const
+{
+    auto x = select_node(k);
+    if (x == nullptr)
+        return false;
+    found = x->key;
+    value = x->value;
+    return true;
+}
+
+// Towers are part of their node, the head's full height tower is auxiliary
+template <typename T, typename Key, typename Compare, typename alloc_T>
+MemoryUsage SkipList<T, Key, Compare, alloc_T>::memory_usage() const
+{
+    MemoryUsage usage;
+    std::size_t used = alloc.block_size(SkipNode::bytes(max_level));
+    for (auto x = head->next(0); x != nullptr; x = x->next(0))
+    {
+        auto bytes = alloc.block_size(SkipNode::bytes(x->level));
+        usage.add_entry(x->key, x->value);
+        usage.node_bytes += bytes - sizeof(T);
+        used += bytes;
+    }
+    usage.nodes = sz;
+    usage.aux_bytes = sizeof(*this) + alloc.block_size(SkipNode::bytes(max_level)) + allocator_slack(alloc, used);
+    return usage;
+}
+
+// The depth of a key is the nodes a search for it steps onto, itself included
+template <typename T, typename Key, typename Compare, typename alloc_T>
+ShapeStats SkipList<T, Key, Compare, alloc_T>::shape_stats() const
+{
+    ShapeStats stats;
+    stats.height = level;
+    stats.levels.assign(towers + 1, towers + level + 1);
+    long total = 0;
+    for (auto y = head->next(0); y != nullptr; y = y->next(0))
+    {
+        auto x = head;
+        for (int i = level - 1; i >= 0; i--)
+            while (x->next(i) != nullptr && order::less(x->next(i)->key, y->key))
+            {
+                total++;
+                x = x->next(i);
+            }
+        total++;
+    }
+    stats.mean_depth = sz == 0 ? 0 : double(total) / sz;
+    counters.report(stats);
+    return stats;
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::display_levels()
+{
+    for (int i = level; i >= 0; i--)
+    {
+        std::cout << '-'; // head
+        for (auto x = head->next(0); x != nullptr; x = x->next(0))
+        {
+            if (x->level > i)
+                std::cout << '-';
+            else
+                std::cout << ' ';
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Rebuilds the towers so the node at position p has one level for every
+// power of fanout (two for p = 0.5) dividing p, in one pass. Towers are inline, so a node whose height
+// changes is moved to a new allocation of the right size
+template <typename T, typename Key, typename Compare, typename alloc_T>
+void SkipList<T, Key, Compare, alloc_T>::reconfigure()
+{
+    auto levels = layout_levels(sz);
+    SkipNode *last[max_level];
+    int last_pos[max_level] = {};
+    std::fill(last, last + max_level, head);
+    std::fill(towers, towers + max_level + 1, 0);
+    fingered = false;
+    auto x = head->next(0);
+    level = 0;
+    for (int p = 1; x != nullptr; p++)
+    {
+        auto next = x->next(0);
+        auto l = layout_level(p, levels);
+        if (x->level != l)
+        {
+            auto y = make_node(alloc, l, x->key, std::move(x->value));
+            free_node(x);
+            x = y;
+        }
+        x->prev = last[0];
+        for (int i = 0; i < l; i++)
+        {
+            last[i]->next(i) = x;
+            last[i]->width(i) = p - last_pos[i];
+            last[i] = x;
+            last_pos[i] = p;
+        }
+        towers[l]++;
+        level = std::max(level, l);
+        x = next;
+    }
+    for (int i = 0; i < max_level; i++)
+    {
+        last[i]->next(i) = nullptr;
+        last[i]->width(i) = sz + 1 - last_pos[i];
+    }
+    rebalancing = false;
+    until_check = rebalance_interval;
+    path_average = layout_path(sz);
+}
+
+template <typename T, typename Key, typename Compare, typename alloc_T>
+SkipList<T, Key, Compare, alloc_T>::~SkipList()
+{
+    clear();
+    free_node(head);
+}
+
+template <typename U, typename K, typename C, typename A>
+std::ostream& operator<<(std::ostream &os, const SkipList<U, K, C, A> &list)
+{
+    auto x = list.head->next(0);
+    while (x != nullptr)
     {
         os << "Key: " << x->key << " "
            << "Value: " << x->value << " "
-           << "Level: " << list.node_level(x->forward) << std::endl;
-        x = x->forward[0]; 
+           << "Level: " << x->level - 1 << std::endl;
+        x = x->next(0);
     }
-    return os; 
+    return os;
 }
 
-#endif 
+#endif
@@ -0,0 +1,405 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+/*
+    Map snapshots
+    save_snapshot writes any map here to a file and load_snapshot bulk
+    loads one back, so a restart need not rebuild a map one insert at a
+    time. The file holds no pointers: a versioned header, the keys in
+    order, the values, and for the skip list and treap the shape of each
+    node (tower heights or priorities) so the same structure comes back
+    rather than a freshly randomised one. Each section starts on a cache
+    line. Keys and values of trivially copyable types are stored as raw
+    arrays, strings as an array of offsets into their bytes.
+    MappedSnapshot opens a file with mmap and answers read only queries
+    from it in place, binary searching the key array without copying it.
+    Files are in the writer's byte order and only the sizes of the key
+    and value types are checked, a file must be read with the types it
+    was written with.
+*/
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "key_traits.hpp"
+
+enum class SnapshotShape : std::uint32_t
+{
+    none = 0,
+    tower_heights = 1, // the skip list's levels per node
+    priorities = 2,    // the treap's heap priorities
+};
+
+struct SnapshotHeader
+{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byte_order; // snapshot_byte_order as the writer stored it
+    std::uint64_t count;
+    std::uint32_t key_size, value_size; // sizeof each, 0 for strings
+    SnapshotShape shape;
+    std::uint32_t reserved;
+    std::uint64_t keys, values, shapes; // file offsets of the sections, shapes is 0 without a shape
+    std::uint64_t bytes; // the whole file, anything shorter was cut off
+};
+
+inline constexpr char snapshot_magic[8] = {'D', 'S', 'S', 'N', 'A', 'P', 0, 0};
+inline constexpr std::uint32_t snapshot_version = 1;
+inline constexpr std::uint32_t snapshot_byte_order = 0x01020304;
+inline constexpr std::uint64_t snapshot_align = 64;
+
+// How one type is laid out in a section
+template <typename X, typename = void>
+struct SnapshotColumn
+{
+    static_assert(std::is_trivially_copyable_v<X>, "snapshots hold trivially copyable types and std::string");
+    static constexpr std::uint32_t element_size = sizeof(X);
+
+    // each(put) calls put(x) for every element in order
+    template <typename Each>
+    static void write(std::ostream &out, Each each)
+    {
+        each([&](const X &x) { out.write(reinterpret_cast<const char *>(&x), sizeof(X)); });
+    }
+    static bool fits(const char *, std::uint64_t count, std::uint64_t available) { return count <= available / sizeof(X); }
+    static X read(const char *section, std::uint64_t, std::uint64_t i)
+    {
+        X x;
+        std::memcpy(&x, section + i * sizeof(X), sizeof(X));
+        return x;
+    }
+};
+
+// count + 1 offsets, string i is bytes [offsets[i], offsets[i + 1]) of what follows them
+template <>
+struct SnapshotColumn<std::string>
+{
+    static constexpr std::uint32_t element_size = 0;
+
+    template <typename Each>
+    static void write(std::ostream &out, Each each)
+    {
+        std::uint64_t offset = 0;
+        auto put = [&](std::uint64_t o) { out.write(reinterpret_cast<const char *>(&o), sizeof(o)); };
+        put(offset);
+        each([&](const std::string &s) { put(offset += s.size()); });
+        each([&](const std::string &s) { out.write(s.data(), s.size()); });
+    }
+    static const std::uint64_t *offsets(const char *section) { return reinterpret_cast<const std::uint64_t *>(section); }
+    static bool fits(const char *section, std::uint64_t count, std::uint64_t available)
+    {
+        if (count >= available / sizeof(std::uint64_t))
+            return false;
+        auto bytes = available - (count + 1) * sizeof(std::uint64_t);
+        auto o = offsets(section);
+        for (std::uint64_t i = 0; i < count; i++)
+            if (o[i] > o[i + 1])
+                return false;
+        return o[0] == 0 && o[count] <= bytes;
+    }
+    static std::string read(const char *section, std::uint64_t count, std::uint64_t i)
+    {
+        auto o = offsets(section);
+        auto bytes = section + (count + 1) * sizeof(std::uint64_t);
+        return std::string(bytes + o[i], o[i + 1] - o[i]);
+    }
+};
+
+// A whole file mapped read only, unmapped when destroyed
+class MappedFile
+{
+private:
+    const char *base;
+    std::size_t length;
+
+public:
+    explicit MappedFile(const std::string &path) : base(nullptr), length(0)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedFile: cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && st.st_size > 0)
+        {
+            auto p = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED)
+            {
+                base = static_cast<const char *>(p);
+                length = st.st_size;
+            }
+        }
+        ::close(fd);
+        if (base == nullptr)
+            throw std::runtime_error("MappedFile: cannot map " + path);
+    }
+    MappedFile(MappedFile &&other) noexcept : base(other.base), length(other.length) { other.base = nullptr; }
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile()
+    {
+        if (base != nullptr)
+            ::munmap(const_cast<char *>(base), length);
+    }
+    const char *data() const { return base; }
+    std::size_t size() const { return length; }
+};
+
+// The header of a snapshot of Key to T, after checking every section lies inside the file
+template <typename Key, typename T>
+SnapshotHeader read_snapshot_header(const MappedFile &file)
+{
+    SnapshotHeader header;
+    auto fail = [](const char *why) { throw std::runtime_error(std::string("snapshot: ") + why); };
+    if (file.size() < sizeof(header))
+        fail("file too short");
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0)
+        fail("not a snapshot");
+    if (header.version != snapshot_version)
+        fail("unsupported version");
+    if (header.byte_order != snapshot_byte_order)
+        fail("written with the other byte order");
+    if (header.key_size != SnapshotColumn<Key>::element_size || header.value_size != SnapshotColumn<T>::element_size)
+        fail("key or value type does not match");
+    if (header.bytes != file.size())
+        fail("file cut off");
+    if (header.count > std::uint64_t(std::numeric_limits<int>::max()))
+        fail("too many keys");
+    auto section = [&](std::uint64_t offset) {
+        if (offset < sizeof(header) || offset > file.size() || offset % snapshot_align != 0)
+            fail("bad section offset");
+        return file.size() - offset;
+    };
+    if (!SnapshotColumn<Key>::fits(file.data() + header.keys, header.count, section(header.keys)) ||
+        !SnapshotColumn<T>::fits(file.data() + header.values, header.count, section(header.values)))
+        fail("section overruns the file");
+    if (header.shape != SnapshotShape::none && !SnapshotColumn<std::int32_t>::fits(nullptr, header.count, section(header.shapes)))
+        fail("section overruns the file");
+    return header;
+}
+
+template <typename M, typename = void>
+struct has_tower_heights : std::false_type
+{
+};
+
+template <typename M>
+struct has_tower_heights<M, std::void_t<decltype(std::declval<const M &>().tower_heights())>> : std::true_type
+{
+};
+
+template <typename M, typename = void>
+struct has_priorities : std::false_type
+{
+};
+
+template <typename M>
+struct has_priorities<M, std::void_t<decltype(std::declval<const M &>().priorities())>> : std::true_type
+{
+};
+
+// Writes map to path through a temporary file renamed over it, so path
+// always holds a whole snapshot. M needs for_each, every structure here has it
+template <typename M>
+void save_snapshot(const M &map, const std::string &path)
+{
+    using Key = typename M::key_type;
+    using T = typename M::mapped_type;
+    auto keys = [&](auto put) { map.for_each([&](const Key &key, const T &) { put(key); }); };
+    auto values = [&](auto put) { map.for_each([&](const Key &, const T &value) { put(value); }); };
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.byte_order = snapshot_byte_order;
+    header.key_size = SnapshotColumn<Key>::element_size;
+    header.value_size = SnapshotColumn<T>::element_size;
+    keys([&](const Key &) { header.count++; });
+    std::vector<int> shape;
+    if constexpr (has_tower_heights<M>::value)
+    {
+        header.shape = SnapshotShape::tower_heights;
+        shape = map.tower_heights();
+    }
+    else if constexpr (has_priorities<M>::value)
+    {
+        header.shape = SnapshotShape::priorities;
+        shape = map.priorities();
+    }
+
+    auto temp = path + ".tmp";
+    std::ofstream out(temp, std::ios::binary | std::ios::trunc);
+    if (!out)
+        throw std::runtime_error("save_snapshot: cannot write " + temp);
+    auto align = [&] {
+        static const char zeros[snapshot_align] = {};
+        auto at = std::uint64_t(out.tellp());
+        out.write(zeros, (snapshot_align - at % snapshot_align) % snapshot_align);
+        return std::uint64_t(out.tellp());
+    };
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    header.keys = align();
+    SnapshotColumn<Key>::write(out, keys);
+    header.values = align();
+    SnapshotColumn<T>::write(out, values);
+    if (header.shape != SnapshotShape::none)
+    {
+        header.shapes = align();
+        SnapshotColumn<std::int32_t>::write(out, [&](auto put) {
+            for (auto s : shape)
+                put(std::int32_t(s));
+        });
+    }
+    header.bytes = align();
+    out.seekp(0);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.close();
+    if (!out || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temp.c_str());
+        throw std::runtime_error("save_snapshot: cannot write " + path);
+    }
+}
+
+// Replaces the contents of map with the snapshot at path through bulk_load.
+// A skip list or treap loading a snapshot of its own kind gets the saved
+// shape back, any other map just gets the keys
+template <typename M>
+void load_snapshot(M &map, const std::string &path)
+{
+    using Key = typename M::key_type;
+    using T = typename M::mapped_type;
+    using order = KeyOrder<Key, typename M::key_compare>;
+    MappedFile file(path);
+    auto header = read_snapshot_header<Key, T>(file);
+    std::vector<std::pair<Key, T>> items;
+    items.reserve(header.count);
+    for (std::uint64_t i = 0; i < header.count; i++)
+    {
+        items.emplace_back(SnapshotColumn<Key>::read(file.data() + header.keys, header.count, i),
+                           SnapshotColumn<T>::read(file.data() + header.values, header.count, i));
+        // bulk_load trusts its items to be sorted without duplicates
+        if (i > 0 && !order::less(items[i - 1].first, items[i].first))
+            throw std::runtime_error("load_snapshot: keys out of order in " + path);
+    }
+    std::vector<int> shape;
+    for (std::uint64_t i = 0; header.shape != SnapshotShape::none && i < header.count; i++)
+        shape.push_back(SnapshotColumn<std::int32_t>::read(file.data() + header.shapes, header.count, i));
+    if constexpr (has_tower_heights<M>::value)
+    {
+        if (header.shape == SnapshotShape::tower_heights)
+            return map.bulk_load(items, shape);
+    }
+    else if constexpr (has_priorities<M>::value)
+    {
+        if (header.shape == SnapshotShape::priorities)
+            return map.bulk_load(items, shape);
+    }
+    map.bulk_load(items);
+}
+
+// Read only queries on a snapshot file without loading it, the key and
+// value arrays are used where they are mapped. Key and T must be
+// trivially copyable, the file stays mapped for the life of the object
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class MappedSnapshot
+{
+private:
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<T>,
+                  "MappedSnapshot reads keys and values in place, load_snapshot handles other types");
+    using order = KeyOrder<Key, Compare>;
+    MappedFile file;
+    const Key *keys;
+    const T *values;
+    int count;
+
+    bool entry(int pos, Key &found, T &value) const;
+
+public:
+    using key_type = Key;
+    using mapped_type = T;
+    using key_compare = Compare;
+    explicit MappedSnapshot(const std::string &path);
+    int size() const { return count; }
+    // the stored value or nullptr, valid while the snapshot is open
+    const T *lookup(const Key &key) const;
+    bool find(const Key &key, T &value) const;
+    bool lower_bound(const Key &key, Key &found, T &value) const { return entry(lower_bound_keys<Key, Compare>(keys, count, key), found, value); }
+    bool upper_bound(const Key &key, Key &found, T &value) const { return entry(upper_bound_keys<Key, Compare>(keys, count, key), found, value); }
+    int rank(const Key &key) const { return lower_bound_keys<Key, Compare>(keys, count, key); }
+    bool select(int k, Key &found, T &value) const { return entry(k, found, value); }
+    int count_range(const Key &lo, const Key &hi) const { return std::max(0, rank(hi) - rank(lo)); }
+    template <typename Visit>
+    void range(const Key &lo, const Key &hi, Visit &&visit) const;
+    template <typename Visit>
+    void for_each(Visit &&visit) const;
+};
+
+template <typename T, typename Key, typename Compare>
+MappedSnapshot<T, Key, Compare>::MappedSnapshot(const std::string &path) : file(path)
+{
+    auto header = read_snapshot_header<Key, T>(file);
+    keys = reinterpret_cast<const Key *>(file.data() + header.keys);
+    values = reinterpret_cast<const T *>(file.data() + header.values);
+    count = header.count;
+}
+
+template <typename T, typename Key, typename Compare>
+bool MappedSnapshot<T, Key, Compare>::entry(int pos, Key &found, T &value) const
+{
+    if (pos < 0 || pos >= count)
+        return false;
+    found = keys[pos];
+    value = values[pos];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+const T *MappedSnapshot<T, Key, Compare>::lookup(const Key &key) const
+{
+    auto pos = lower_bound_keys<Key, Compare>(keys, count, key);
+    if (pos < count && order::equal(keys[pos], key))
+        return &values[pos];
+    return nullptr;
+}
+
+template <typename T, typename Key, typename Compare>
+bool MappedSnapshot<T, Key, Compare>::find(const Key &key, T &value) const
+{
+    auto slot = lookup(key);
+    if (slot == nullptr)
+        return false;
+    value = *slot;
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename Visit>
+void MappedSnapshot<T, Key, Compare>::range(const Key &lo, const Key &hi, Visit &&visit) const
+{
+    auto end = lower_bound_keys<Key, Compare>(keys, count, hi);
+    for (auto pos = lower_bound_keys<Key, Compare>(keys, count, lo); pos < end; pos++)
+        visit(keys[pos], values[pos]);
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename Visit>
+void MappedSnapshot<T, Key, Compare>::for_each(Visit &&visit) const
+{
+    for (int pos = 0; pos < count; pos++)
+        visit(keys[pos], values[pos]);
+}
+
+#endif
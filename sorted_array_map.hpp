@@ -0,0 +1,284 @@
+#ifndef SORTED_ARRAY_MAP_H
+#define SORTED_ARRAY_MAP_H
+
+/*
+    Sorted array map class
+    Keys and values are kept in two parallel sorted arrays, so lookups
+    are a binary search over contiguous keys, vectorised for int and
+    64 bit keys (see key_traits.hpp), while inserts and erases shift
+    the tail of the arrays. Suited to maps that are loaded once and
+    mostly read.
+*/
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include "ordered_map.hpp"
+
+template <typename T, typename Key = int, typename Compare = std::less<Key>>
+class SortedArrayMap : public OrderedMap<T, Key, Compare>
+{
+private:
+    using order = KeyOrder<Key, Compare>;
+    std::vector<Key> keys;
+    std::vector<T> values;
+    mutable ShapeCounters counters;
+
+    // a search is one binary search of the array
+    void count_search() const
+    {
+        auto probe = counters.probe();
+        probe.step();
+        probe.compare(binary_search_comparisons(keys.size()));
+    }
+    int lower(const Key &key) const
+    {
+        count_search();
+        return lower_bound_keys<Key, Compare>(keys.data(), keys.size(), key);
+    }
+    int upper(const Key &key) const
+    {
+        count_search();
+        return upper_bound_keys<Key, Compare>(keys.data(), keys.size(), key);
+    }
+
+public:
+    using Visitor = typename OrderedMap<T, Key, Compare>::Visitor;
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    T *lookup(const Key &key) override;
+    void clear() override;
+    void insert_batch(const std::vector<std::pair<Key, T>> &items) override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override;
+    void range(const Key &lo, const Key &hi, Visitor visit) const override;
+    void for_each(Visitor visit) const override;
+    bool lower_bound(const Key &key, Key &found, T &value) const override;
+    bool upper_bound(const Key &key, Key &found, T &value) const override;
+    int rank(const Key &key) const override { return lower(key); }
+    MemoryUsage memory_usage() const override;
+    ShapeStats shape_stats() const override;
+    void reset_counters() override { counters.reset(); }
+    bool select(int k, Key &found, T &value) const override;
+    int size() const { return keys.size(); }
+
+    class Iterator
+    {
+    private:
+        const SortedArrayMap *map;
+        int pos;
+
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<Key, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = OrderedEntry<T, Key>;
+        Iterator(const SortedArrayMap *m, int p) : map(m), pos(p) {}
+        Iterator &operator++()
+        {
+            pos++;
+            return *this;
+        }
+        Iterator operator++(int)
+        {
+            auto temp = *this;
+            pos++;
+            return temp;
+        }
+        Iterator &operator--()
+        {
+            pos--;
+            return *this;
+        }
+        Iterator operator--(int)
+        {
+            auto temp = *this;
+            pos--;
+            return temp;
+        }
+        reference operator*() const { return reference(map->keys[pos], map->values[pos]); }
+        bool operator==(const Iterator &rhs) const { return pos == rhs.pos; }
+        bool operator!=(const Iterator &rhs) const { return pos != rhs.pos; }
+    };
+    using ReverseIterator = std::reverse_iterator<Iterator>;
+
+    Iterator begin() const { return Iterator(this, 0); }
+    Iterator end() const { return Iterator(this, keys.size()); }
+    ReverseIterator rbegin() const { return ReverseIterator(end()); }
+    ReverseIterator rend() const { return ReverseIterator(begin()); }
+    Iterator lower_bound(const Key &key) const { return Iterator(this, lower(key)); }
+    Iterator upper_bound(const Key &key) const { return Iterator(this, upper(key)); }
+    Iterator select(int k) const { return Iterator(this, k < 0 || k >= int(keys.size()) ? keys.size() : k); }
+};
+
+// Values shift along the array as keys come and go
+template <typename T, typename Key, typename Compare>
+struct stable_values<SortedArrayMap<T, Key, Compare>> : std::false_type
+{
+};
+
+template <typename T, typename Key, typename Compare>
+T *SortedArrayMap<T, Key, Compare>::lookup(const Key &key)
+{
+    auto pos = lower(key);
+    if (pos < int(keys.size()) && order::equal(keys[pos], key))
+        return &values[pos];
+    return nullptr;
+}
+
+template <typename T, typename Key, typename Compare>
+template <typename... Args>
+std::pair<T *, bool> SortedArrayMap<T, Key, Compare>::emplace(const Key &key, Args &&...args)
+{
+    auto pos = lower(key);
+    if (pos < int(keys.size()) && order::equal(keys[pos], key))
+        return {&values[pos], false};
+    keys.insert(keys.begin() + pos, key);
+    values.emplace(values.begin() + pos, std::forward<Args>(args)...);
+    counters.update();
+    return {&values[pos], true};
+}
+
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::erase(const Key &key)
+{
+    auto pos = lower(key);
+    if (pos < int(keys.size()) && order::equal(keys[pos], key))
+    {
+        keys.erase(keys.begin() + pos);
+        values.erase(values.begin() + pos);
+        counters.update();
+    }
+}
+
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::clear()
+{
+    keys.clear();
+    values.clear();
+}
+
+// Merges the sorted batch with the arrays in one pass instead of shifting per key
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::insert_batch(const std::vector<std::pair<Key, T>> &items)
+{
+    auto by_key = [](const std::pair<Key, T> &a, const std::pair<Key, T> &b) { return order::less(a.first, b.first); };
+    std::vector<std::pair<Key, T>> batch(items);
+    std::stable_sort(batch.begin(), batch.end(), by_key);
+    std::vector<Key> merged_keys;
+    std::vector<T> merged_values;
+    merged_keys.reserve(keys.size() + batch.size());
+    merged_values.reserve(keys.size() + batch.size());
+    std::size_t i = 0, j = 0;
+    while (i < keys.size() || j < batch.size())
+    {
+        if (j == batch.size() || (i < keys.size() && order::less(keys[i], batch[j].first)))
+        {
+            merged_keys.push_back(std::move(keys[i]));
+            merged_values.push_back(std::move(values[i++]));
+            continue;
+        }
+        // later duplicates in the batch win, as does the batch over the map
+        auto &key = batch[j].first;
+        while (j + 1 < batch.size() && order::equal(batch[j + 1].first, key))
+            j++;
+        if (i < keys.size() && order::equal(keys[i], key))
+            i++;
+        merged_keys.push_back(std::move(key));
+        merged_values.push_back(std::move(batch[j++].second));
+    }
+    keys.swap(merged_keys);
+    values.swap(merged_values);
+}
+
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::bulk_load(const std::vector<std::pair<Key, T>> &items)
+{
+    clear();
+    keys.reserve(items.size());
+    values.reserve(items.size());
+    for (const auto &[key, value] : items)
+    {
+        keys.push_back(key);
+        values.push_back(value);
+    }
+}
+
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::range(const Key &lo, const Key &hi, Visitor visit) const
+{
+    auto end = lower(hi);
+    for (auto pos = lower(lo); pos < end; pos++)
+        visit(keys[pos], values[pos]);
+}
+
+template <typename T, typename Key, typename Compare>
+void SortedArrayMap<T, Key, Compare>::for_each(Visitor visit) const
+{
+    for (std::size_t pos = 0; pos < keys.size(); pos++)
+        visit(keys[pos], values[pos]);
+}
+
+template <typename T, typename Key, typename Compare>
+bool SortedArrayMap<T, Key, Compare>::lower_bound(const Key &key, Key &found, T &value) const
+{
+    auto pos = lower(key);
+    if (pos == int(keys.size()))
+        return false;
+    found = keys[pos];
+    value = values[pos];
+    return true;
+}
+
+template <typename T, typename Key, typename Compare>
+bool SortedArrayMap<T, Key, Compare>::upper_bound(const Key &key, Key &found, T &value) const
+{
+    auto pos = upper(key);
+    if (pos == int(keys.size()))
+        return false;
+    found = keys[pos];
+    value = values[pos];
+    return true;
+}
+
+// Every array slot in use is a node, spare capacity is auxiliary
+template <typename T, typename Key, typename Compare>
+MemoryUsage SortedArrayMap<T, Key, Compare>::memory_usage() const
+{
+    MemoryUsage usage;
+    for (std::size_t pos = 0; pos < keys.size(); pos++)
+        usage.add_entry(keys[pos], values[pos]);
+    usage.nodes = keys.size();
+    usage.node_bytes += keys.size() * sizeof(Key);
+    usage.aux_bytes = sizeof(*this) + (keys.capacity() - keys.size()) * sizeof(Key) + (values.capacity() - values.size()) * sizeof(T);
+    return usage;
+}
+
+// The array is one flat node with no path through it
+template <typename T, typename Key, typename Compare>
+ShapeStats SortedArrayMap<T, Key, Compare>::shape_stats() const
+{
+    ShapeStats stats;
+    stats.height = keys.empty() ? 0 : 1;
+    stats.mean_depth = stats.height;
+    counters.report(stats);
+    return stats;
+}
+
+template <typename T, typename Key, typename Compare>
+bool SortedArrayMap<T, Key, Compare>::select(int k, Key &found, T &value) const
+{
+    if (k < 0 || k >= int(keys.size()))
+        return false;
+    found = keys[k];
+    value = values[k];
+    return true;
+}
+
+#endif
@@ -8,96 +8,425 @@
     Treap class that hides the heap values, heap values are 
     randomly generated to attempt to automatically balance 
     a binary search tree. 
+    Set union, intersection and difference are built on split and join 
+    rather than one insert or erase per key. Union first copies the k 
+    keys of the other treap, O(k), then merges in O(m log(n/m + 1)) for 
+    m <= n keys on the two sides. Intersection and difference only read 
+    the other treap, so they split this one around each of its keys they 
+    reach, O(k log n). 
+    A parallel bulk load builds a treap per run of the items on a thread 
+    each and joins them, the heap order on priority makes the result the 
+    same tree a single build makes, barring equal priorities. 
 */
 
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <utility>
+#include <vector>
 #include "binary_search_tree.hpp"
 
-template <typename T>
+// rand() is not safe to call from several threads at once, so priorities
+// come from an xorshift64* generator per thread, each seeded differently
+inline int treap_priority()
+{
+    static std::atomic<std::uint64_t> threads{0};
+    thread_local std::uint64_t state = ++threads * 0x9E3779B97F4A7C15ull;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return int((state * 0x2545F4914F6CDD1Dull) >> 33);
+}
+
+template <typename T, typename Key = int>
 struct TreapNode
 {
-    int key;
+    Key key;
     T value;
-    TreapNode *left, *right;
+    TreapNode *left, *right, *parent;
+    int size;
     int priority;
-    TreapNode(int k, const T &v) : key(k), value(v), left(nullptr), right(nullptr), priority(rand()) {}
+    template <typename... Args>
+    TreapNode(const Key &k, Args &&...args) : key(k), value(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent(nullptr), size(1), priority(treap_priority()) {}
 };
 
 
-template <typename T, typename node_T = TreapNode<T>>
-class Treap : public BST<T, node_T>
+template <typename T, typename Key = int, typename Compare = std::less<Key>, typename node_T = TreapNode<T, Key>, typename alloc_T = PoolAllocator>
+class Treap : public BST<T, Key, Compare, node_T, alloc_T>
 {
 protected:
-    void insert(node_T *&node, int key, const T &value);
-    void erase(node_T *&node, int key);
+    using order = KeyOrder<Key, Compare>;
+    // Nodes to free once an operation is done, they are kept aside so the
+    // forked halves of a parallel operation never touch the allocator
+    using Garbage = std::vector<node_T *>;
+
+    static node_T *attach(node_T *node, node_T *left, node_T *right);
+    static node_T *split(node_T *node, const Key &key, node_T *&less, node_T *&greater);
+    static node_T *join(node_T *less, node_T *greater);
+    static node_T *unite(node_T *a, node_T *b, bool a_wins, int depth, Garbage &garbage);
+    static node_T *intersect(node_T *node, const node_T *other, int depth, Garbage &garbage);
+    static node_T *subtract(node_T *node, const node_T *other, int depth, Garbage &garbage);
+    template <typename L, typename R>
+    static node_T *fork(int depth, Garbage &garbage, L left, R right, node_T *&right_result);
+    node_T *clone(const node_T *node);
+    void collect(Garbage &garbage);
+    static node_T *cartesian(alloc_T &alloc, const std::vector<std::pair<Key, T>> &items, const std::vector<int> *priorities, std::size_t lo, std::size_t hi);
+    void build(const std::vector<std::pair<Key, T>> &items, const std::vector<int> *priorities, bool parallel = false);
+    static int fork_depth;
 
 public:
-    void insert(int key, const T &value) override { insert(this->root, key, value); }
-    void erase(int key) override { erase(this->root, key); }
+    void insert(const Key &key, const T &value) override { insert_or_assign(key, value); }
+    void insert(const Key &key, T &&value) override { insert_or_assign(key, std::move(value)); }
+    template <typename... Args>
+    std::pair<T *, bool> emplace(const Key &key, Args &&...args);
+    template <typename V>
+    bool insert_or_assign(const Key &key, V &&value) { return emplace_or_assign(*this, key, std::forward<V>(value)); }
+    void erase(const Key &key) override;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items) override { build(items, nullptr); }
+    // each node's priority in key order, and a bulk load that gives node i
+    // priorities[i], so a saved treap comes back with the same shape
+    std::vector<int> priorities() const;
+    void bulk_load(const std::vector<std::pair<Key, T>> &items, const std::vector<int> &priorities) { build(items, &priorities); }
+    // parallel builds a run of the items per thread, see fork_join.hpp
+    void bulk_load(const std::vector<std::pair<Key, T>> &items, bool parallel) { build(items, nullptr, parallel); }
+    // Each of these leaves the result in this treap, keeping this treap's
+    // value for a key in both. parallel forks the top levels of the recursion
+    void set_union(const Treap &other, bool parallel = false);
+    void set_intersection(const Treap &other, bool parallel = false);
+    void set_difference(const Treap &other, bool parallel = false);
 };
 
-template <typename T, typename node_T>
-void Treap<T, node_T>::insert(node_T *&node, int key, const T &value)
+// Inserts as a leaf then follows parent pointers up, rotating the new node
+// above every parent with a lower priority
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename... Args>
+std::pair<T *, bool> Treap<T, Key, Compare, node_T, alloc_T>::emplace(const Key &key, Args &&...args)
 {
-    if (node == nullptr) // make a new node
-        node = new node_T(key, value);
-    else
+    auto [node, inserted] = this->emplace_leaf(key, std::forward<Args>(args)...);
+    if (!inserted)
+        return {&node->value, false};
+    while (node->parent != nullptr && node->parent->priority < node->priority)
     {
-        if (node->key == key)
-        {
-            node->value = value;
-            return;
-        }
-        if (key < node->key)
-        {
-            insert(node->left, key, value);
-            if (node->left->priority > node->priority)
-                this->rotate_right(node);
-        }
+        auto parent = node->parent;
+        if (parent->left == node)
+            this->rotate_right(this->link(parent));
         else
-        {
-            insert(node->right, key, value);
-            if (node->right->priority > node->priority)
-                this->rotate_left(node);
-        }
+            this->rotate_left(this->link(parent));
     }
+    return {&node->value, true};
 }
 
-template <typename T, typename node_T>
-void Treap<T, node_T>::erase(node_T *&node, int key)
+// Rotates the node down below its higher priority child until it has at most one child
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::erase(const Key &key)
 {
+    auto node = this->find_node(key, this->resume(key));
     if (node == nullptr)
         return;
-    if (key > node->key)
-        erase(node->right, key);
-    else if (key < node->key)
-        erase(node->left, key);
-    else
+    while (node->left != nullptr && node->right != nullptr)
     {
-        if (node->left == nullptr && node->right == nullptr)
-        {
-            delete node;
-            node = nullptr;
-        }
-        else if (node->left == nullptr || node->right == nullptr)
+        if (node->left->priority < node->right->priority)
+            this->rotate_left(this->link(node));
+        else
+            this->rotate_right(this->link(node));
+    }
+    this->finger = this->unlink_node(node);
+    this->free_node(node);
+}
+
+// Builds the Cartesian tree of the sorted items[lo, hi) in O(n), the stack holds the
+// right spine of the tree built so far so the heap property is kept on priority.
+// Nodes keep their random priorities when priorities is null
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::cartesian(alloc_T &alloc, const std::vector<std::pair<Key, T>> &items, const std::vector<int> *priorities, std::size_t lo, std::size_t hi)
+{
+    std::vector<node_T *> spine;
+    for (auto i = lo; i < hi; i++)
+    {
+        auto node = create_node<node_T>(alloc, items[i].first, items[i].second);
+        if (priorities != nullptr)
+            node->priority = (*priorities)[i];
+        node_T *last = nullptr;
+        while (!spine.empty() && spine.back()->priority < node->priority)
         {
-            auto temp = node;
-            node = (node->left == nullptr) ? node->right : node->left;
-            delete temp;
+            last = spine.back();
+            spine.pop_back();
+            Treap::update_size(last); // its subtree is final once off the spine
         }
-        else
+        node->left = last;
+        if (last != nullptr)
+            last->parent = node;
+        if (!spine.empty())
         {
-            if (node->left->priority < node->right->priority)
-            {
-                this->rotate_left(node);
-                erase(node->left, key);
-            }
-            else
-            {
-                this->rotate_right(node);
-                erase(node->right, key);
-            }
+            spine.back()->right = node;
+            node->parent = spine.back();
         }
+        spine.push_back(node);
+    }
+    for (auto node = spine.rbegin(); node != spine.rend(); ++node)
+        Treap::update_size(*node);
+    return spine.empty() ? nullptr : spine.front();
+}
+
+// Every run's nodes come from an allocator of its own, which this treap's
+// adopts once they are built. Joining the runs in order only walks the
+// spines where they meet
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::build(const std::vector<std::pair<Key, T>> &items, const std::vector<int> *priorities, bool parallel)
+{
+    this->clear();
+    auto n = items.size();
+    auto pieces = parallel_pieces(n, parallel);
+    if (pieces == 1)
+    {
+        this->root = cartesian(this->alloc, items, priorities, 0, n);
+        return;
+    }
+    std::vector<alloc_T> allocs(pieces);
+    std::vector<node_T *> roots(pieces);
+    run_pieces(pieces, [&](int j) { roots[j] = cartesian(allocs[j], items, priorities, piece_begin(n, pieces, j), piece_begin(n, pieces, j + 1)); });
+    node_T *root = nullptr;
+    for (int j = 0; j < pieces; j++)
+    {
+        this->alloc.adopt(std::move(allocs[j]));
+        root = join(root, roots[j]);
+    }
+    root->parent = nullptr;
+    this->root = root;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+std::vector<int> Treap<T, Key, Compare, node_T, alloc_T>::priorities() const
+{
+    std::vector<int> result;
+    result.reserve(this->size());
+    for (auto node = this->root == nullptr ? nullptr : this->next_node(nullptr); node != nullptr; node = this->next_node(node))
+        result.push_back(node->priority);
+    return result;
+}
+
+/*
+    Split and join engine
+    The recursions below descend one level of a treap per call, so they are
+    O(log n) deep in expectation and are left recursive. Parent pointers of
+    subtree roots and subtree sizes are only made right by attach(), callers
+    attach every result before it is reachable from the root.
+*/
+
+// Enough levels to give every hardware thread a subtree, 0 forks nothing
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+int Treap<T, Key, Compare, node_T, alloc_T>::fork_depth = [] {
+    int depth = 0;
+    while ((2u << depth) <= std::thread::hardware_concurrency() && depth < 6)
+        depth++;
+    return depth;
+}();
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::attach(node_T *node, node_T *left, node_T *right)
+{
+    node->left = left;
+    node->right = right;
+    if (left != nullptr)
+        left->parent = node;
+    if (right != nullptr)
+        right->parent = node;
+    Treap::update_size(node);
+    return node;
+}
+
+// Splits node into the keys below and above key, returning the node holding
+// key itself (detached from both halves) or nullptr
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::split(node_T *node, const Key &key, node_T *&less, node_T *&greater)
+{
+    if (node == nullptr)
+    {
+        less = greater = nullptr;
+        return nullptr;
+    }
+    auto c = order::compare(key, node->key);
+    if (c == 0)
+    {
+        less = node->left;
+        greater = node->right;
+        attach(node, nullptr, nullptr);
+        return node;
+    }
+    node_T *found;
+    if (c < 0)
+    {
+        node_T *inner;
+        found = split(node->left, key, less, inner);
+        greater = attach(node, inner, node->right);
+    }
+    else
+    {
+        node_T *inner;
+        found = split(node->right, key, inner, greater);
+        less = attach(node, node->left, inner);
+    }
+    return found;
+}
+
+// Joins two treaps where every key in less is below every key in greater
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::join(node_T *less, node_T *greater)
+{
+    if (less == nullptr)
+        return greater;
+    if (greater == nullptr)
+        return less;
+    if (less->priority > greater->priority)
+        return attach(less, less->left, join(less->right, greater));
+    return attach(greater, join(less, greater->left), greater->right);
+}
+
+// Runs left and right, the left half on another thread near the top of the recursion
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+template <typename L, typename R>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::fork(int depth, Garbage &garbage, L left, R right, node_T *&right_result)
+{
+    if (depth >= fork_depth)
+    {
+        right_result = right(garbage);
+        return left(garbage);
+    }
+    Garbage left_garbage;
+    auto future = std::async(std::launch::async, [&] { return left(left_garbage); });
+    right_result = right(garbage);
+    auto result = future.get();
+    garbage.insert(garbage.end(), left_garbage.begin(), left_garbage.end());
+    return result;
+}
+
+// The root with the higher priority stays on top and the other treap is
+// split around it. a_wins says whose value a shared key keeps
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::unite(node_T *a, node_T *b, bool a_wins, int depth, Garbage &garbage)
+{
+    if (a == nullptr)
+        return b;
+    if (b == nullptr)
+        return a;
+    if (a->priority < b->priority)
+    {
+        std::swap(a, b);
+        a_wins = !a_wins;
+    }
+    node_T *less, *greater;
+    auto same = split(b, a->key, less, greater);
+    if (same != nullptr)
+    {
+        if (!a_wins)
+            std::swap(a->value, same->value);
+        garbage.push_back(same);
+    }
+    node_T *right;
+    auto left = fork(
+        depth, garbage,
+        [&](Garbage &g) { return unite(a->left, less, a_wins, depth + 1, g); },
+        [&](Garbage &g) { return unite(a->right, greater, a_wins, depth + 1, g); },
+        right);
+    return attach(a, left, right);
+}
+
+// Keeps the keys of node that are also in other, other is only read
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::intersect(node_T *node, const node_T *other, int depth, Garbage &garbage)
+{
+    if (node == nullptr)
+        return nullptr;
+    if (other == nullptr)
+    {
+        garbage.push_back(node);
+        return nullptr;
+    }
+    node_T *less, *greater;
+    auto same = split(node, other->key, less, greater);
+    node_T *right;
+    auto left = fork(
+        depth, garbage,
+        [&](Garbage &g) { return intersect(less, other->left, depth + 1, g); },
+        [&](Garbage &g) { return intersect(greater, other->right, depth + 1, g); },
+        right);
+    if (same == nullptr)
+        return join(left, right);
+    return join(join(left, same), right);
+}
+
+// Drops the keys of node that are in other, other is only read
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::subtract(node_T *node, const node_T *other, int depth, Garbage &garbage)
+{
+    if (node == nullptr || other == nullptr)
+        return node;
+    node_T *less, *greater;
+    auto same = split(node, other->key, less, greater);
+    if (same != nullptr)
+        garbage.push_back(same);
+    node_T *right;
+    auto left = fork(
+        depth, garbage,
+        [&](Garbage &g) { return subtract(less, other->left, depth + 1, g); },
+        [&](Garbage &g) { return subtract(greater, other->right, depth + 1, g); },
+        right);
+    return join(left, right);
+}
+
+// Copies other's nodes into this treap's allocator with their priorities, so the shape is kept
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+node_T *Treap<T, Key, Compare, node_T, alloc_T>::clone(const node_T *node)
+{
+    if (node == nullptr)
+        return nullptr;
+    auto copy = create_node<node_T>(this->alloc, node->key, node->value);
+    copy->priority = node->priority;
+    return attach(copy, clone(node->left), clone(node->right));
+}
+
+// Frees the detached subtrees an operation left behind
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::collect(Garbage &garbage)
+{
+    for (auto node : garbage)
+        this->deleteTree(node);
+    if (this->root != nullptr)
+        this->root->parent = nullptr;
+    this->finger = nullptr;
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::set_union(const Treap &other, bool parallel)
+{
+    Garbage garbage;
+    auto copy = clone(other.root);
+    this->root = unite(this->root, copy, true, parallel ? 0 : fork_depth, garbage);
+    collect(garbage);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::set_intersection(const Treap &other, bool parallel)
+{
+    if (&other == this) // intersect would free nodes other still reads
+        return;
+    Garbage garbage;
+    this->root = intersect(this->root, other.root, parallel ? 0 : fork_depth, garbage);
+    collect(garbage);
+}
+
+template <typename T, typename Key, typename Compare, typename node_T, typename alloc_T>
+void Treap<T, Key, Compare, node_T, alloc_T>::set_difference(const Treap &other, bool parallel)
+{
+    if (&other == this)
+    {
+        this->clear(parallel);
+        return;
     }
+    Garbage garbage;
+    this->root = subtract(this->root, other.root, parallel ? 0 : fork_depth, garbage);
+    collect(garbage);
 }
 
 #endif 